@@ -0,0 +1,517 @@
+#ifndef ATTENTION_H
+#define ATTENTION_H
+
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <random>
+#include <vector>
+#include <malloc.h>
+
+#include "embedding.h"
+#include "gemm.h"
+#include "threadPool.h"
+
+
+class attention {
+public:
+
+    static constexpr int queryTile = 64;
+
+    static constexpr int keyTile = 64;
+
+
+
+    struct weights {
+
+        int dModel = 0;
+
+        int heads = 0;
+
+        std::vector<float> query;
+
+        std::vector<float> key;
+
+        std::vector<float> value;
+
+        std::vector<float> output;
+    };
+
+
+
+    static void initializeWeights(weights &w, const int &dModel, const int &heads, std::mt19937 &rng) {
+
+        const float limit = std::sqrt(6.0f / (2.0f * dModel));
+
+        std::uniform_real_distribution<float> dist(-limit, limit);
+
+        w.dModel = dModel;
+
+        w.heads = heads;
+
+        for (auto* matrix : {&w.query, &w.key, &w.value, &w.output}) {
+
+            matrix->resize(static_cast<size_t>(dModel) * dModel);
+
+            for (auto& i : *matrix) {
+                i = dist(rng);
+            }
+        }
+    }
+
+
+    static void gatherEmbeddings(const std::vector<int> &tokens, const tensor<float> &embeddings, const int &dModel, std::vector<float> &x) {
+
+        x.resize(tokens.size() * dModel);
+
+        for (size_t i = 0; i < tokens.size(); i++) {
+
+            std::copy_n(embeddings.row(tokens[i]), dModel, x.data() + i * dModel);
+        }
+    }
+
+
+
+    static void project(const float* x, const float* w, float* y, const int &rows, const int &inputs, const int &outputs) {
+
+        gemm::multiply(false, false, rows, outputs, inputs, x, inputs, w, outputs, y, outputs);
+    }
+
+
+    static void splitHeads(const std::vector<float> &x, const int &seqLength, const int &heads, const int &headDimension, std::vector<float> &headMajor) {
+
+        headMajor.resize(x.size());
+
+        for (int h = 0; h < heads; h++) {
+            for (int i = 0; i < seqLength; i++) {
+
+                std::copy_n(x.data() + (static_cast<size_t>(i) * heads + h) * headDimension, headDimension,
+                    headMajor.data() + (static_cast<size_t>(h) * seqLength + i) * headDimension);
+            }
+        }
+    }
+
+
+    static void mergeHeads(const std::vector<float> &headMajor, const int &seqLength, const int &heads, const int &headDimension, std::vector<float> &x) {
+
+        x.resize(headMajor.size());
+
+        for (int h = 0; h < heads; h++) {
+            for (int i = 0; i < seqLength; i++) {
+
+                std::copy_n(headMajor.data() + (static_cast<size_t>(h) * seqLength + i) * headDimension, headDimension,
+                    x.data() + (static_cast<size_t>(i) * heads + h) * headDimension);
+            }
+        }
+    }
+
+
+
+    static size_t tileScratchFloats(const int &headDimension) {
+        return static_cast<size_t>(queryTile) * keyTile + static_cast<size_t>(queryTile) * headDimension + 2 * queryTile;
+    }
+
+
+    static void attendTile(
+        const float* q,
+        const float* k,
+        const float* v,
+        float* o,
+        const int &headDimension,
+        const int &queryStart,
+        const int &queryEnd,
+        const float &scale,
+        float* scratch) {
+
+        float* scores = scratch;
+
+        float* accumulator = scores + queryTile * keyTile;
+
+        float* maxima = accumulator + queryTile * headDimension;
+
+        float* sums = maxima + queryTile;
+
+        const int queries = queryEnd - queryStart;
+
+        std::fill(accumulator, accumulator + queries * headDimension, 0.0f);
+
+        std::fill(maxima, maxima + queries, -std::numeric_limits<float>::infinity());
+
+        std::fill(sums, sums + queries, 0.0f);
+
+
+        for (int keyStart = 0; keyStart < queryEnd; keyStart += keyTile) {
+
+            const int keyEnd = std::min(keyStart + keyTile, queryEnd);
+
+            const int keys = keyEnd - keyStart;
+
+            for (int i = 0; i < queries; i++) {
+
+                const int query = queryStart + i;
+
+                const float* qRow = q + static_cast<size_t>(query) * headDimension;
+
+                float* sRow = scores + i * keyTile;
+
+                const int visible = std::min(keys, query - keyStart + 1);
+
+                float tileMaximum = -std::numeric_limits<float>::infinity();
+
+                for (int j = 0; j < visible; j++) {
+
+                    sRow[j] = embedding::dotProduct(k + static_cast<size_t>(keyStart + j) * headDimension, qRow, headDimension) * scale;
+
+                    tileMaximum = std::max(tileMaximum, sRow[j]);
+                }
+
+                if (visible <= 0) {
+                    continue;
+                }
+
+                const float newMaximum = std::max(maxima[i], tileMaximum);
+
+                const float correction = std::exp(maxima[i] - newMaximum);
+
+                float* aRow = accumulator + i * headDimension;
+
+                if (correction != 1.0f) {
+
+                    for (int d = 0; d < headDimension; d++) {
+                        aRow[d] *= correction;
+                    }
+                }
+
+                float tileSum = 0;
+
+                for (int j = 0; j < visible; j++) {
+
+                    const float p = std::exp(sRow[j] - newMaximum);
+
+                    tileSum += p;
+
+                    const float* vRow = v + static_cast<size_t>(keyStart + j) * headDimension;
+
+                    for (int d = 0; d < headDimension; d++) {
+                        aRow[d] += p * vRow[d];
+                    }
+                }
+
+                sums[i] = sums[i] * correction + tileSum;
+
+                maxima[i] = newMaximum;
+            }
+        }
+
+
+        for (int i = 0; i < queries; i++) {
+
+            const float inverse = 1.0f / sums[i];
+
+            float* oRow = o + static_cast<size_t>(queryStart + i) * headDimension;
+
+            const float* aRow = accumulator + i * headDimension;
+
+            for (int d = 0; d < headDimension; d++) {
+                oRow[d] = aRow[d] * inverse;
+            }
+        }
+    }
+
+
+    static void flashAttention(
+        const std::vector<float> &q,
+        const std::vector<float> &k,
+        const std::vector<float> &v,
+        std::vector<float> &o,
+        const int &seqLength,
+        const int &heads,
+        const int &headDimension,
+        std::vector<float> &scratch) {
+
+        o.resize(q.size());
+
+        const int tiles = (seqLength + queryTile - 1) / queryTile;
+
+        const float scale = 1.0f / std::sqrt(static_cast<float>(headDimension));
+
+        const size_t perThread = tileScratchFloats(headDimension);
+
+        scratch.resize(perThread * threadPool::instance().size());
+
+        threadPool::parallelFor(heads * tiles, [&](const int item, const int thread) {
+
+            const int h = item % heads;
+
+            const int tile = tiles - 1 - item / heads;
+
+            const size_t offset = static_cast<size_t>(h) * seqLength * headDimension;
+
+            attendTile(
+                q.data() + offset,
+                k.data() + offset,
+                v.data() + offset,
+                o.data() + offset,
+                headDimension,
+                tile * queryTile,
+                std::min(seqLength, (tile + 1) * queryTile),
+                scale,
+                scratch.data() + perThread * thread);
+        });
+    }
+
+
+    static void naiveAttention(
+        const std::vector<float> &q,
+        const std::vector<float> &k,
+        const std::vector<float> &v,
+        std::vector<float> &o,
+        const int &seqLength,
+        const int &heads,
+        const int &headDimension,
+        std::vector<float> &scores) {
+
+        o.assign(q.size(), 0.0f);
+
+        scores.resize(static_cast<size_t>(seqLength) * seqLength);
+
+        const float scale = 1.0f / std::sqrt(static_cast<float>(headDimension));
+
+        for (int h = 0; h < heads; h++) {
+
+            const size_t offset = static_cast<size_t>(h) * seqLength * headDimension;
+
+            for (int i = 0; i < seqLength; i++) {
+
+                float* sRow = scores.data() + static_cast<size_t>(i) * seqLength;
+
+                for (int j = 0; j < seqLength; j++) {
+
+                    sRow[j] = j > i ? -std::numeric_limits<float>::infinity()
+                    : embedding::dotProduct(k.data() + offset + static_cast<size_t>(j) * headDimension, q.data() + offset + static_cast<size_t>(i) * headDimension, headDimension) * scale;
+                }
+
+                const float maximum = *std::max_element(sRow, sRow + seqLength);
+
+                float sum = 0;
+
+                for (int j = 0; j < seqLength; j++) {
+
+                    sRow[j] = std::exp(sRow[j] - maximum);
+
+                    sum += sRow[j];
+                }
+
+                for (int j = 0; j < seqLength; j++) {
+                    sRow[j] /= sum;
+                }
+            }
+
+            for (int i = 0; i < seqLength; i++) {
+
+                float* oRow = o.data() + offset + static_cast<size_t>(i) * headDimension;
+
+                for (int j = 0; j < seqLength; j++) {
+
+                    const float p = scores[static_cast<size_t>(i) * seqLength + j];
+
+                    const float* vRow = v.data() + offset + static_cast<size_t>(j) * headDimension;
+
+                    for (int d = 0; d < headDimension; d++) {
+                        oRow[d] += p * vRow[d];
+                    }
+                }
+            }
+        }
+    }
+
+
+
+    static void forward(const weights &w, const std::vector<float> &x, const int &seqLength, std::vector<float> &y, const bool &naive = false) {
+
+        const int headDimension = w.dModel / w.heads;
+
+        std::vector<float> projected(x.size());
+
+        std::vector<float> q, k, v, o, scratch;
+
+        project(x.data(), w.query.data(), projected.data(), seqLength, w.dModel, w.dModel);
+
+        splitHeads(projected, seqLength, w.heads, headDimension, q);
+
+        project(x.data(), w.key.data(), projected.data(), seqLength, w.dModel, w.dModel);
+
+        splitHeads(projected, seqLength, w.heads, headDimension, k);
+
+        project(x.data(), w.value.data(), projected.data(), seqLength, w.dModel, w.dModel);
+
+        splitHeads(projected, seqLength, w.heads, headDimension, v);
+
+        if (naive) {
+            naiveAttention(q, k, v, o, seqLength, w.heads, headDimension, scratch);
+        }
+
+        else {
+            flashAttention(q, k, v, o, seqLength, w.heads, headDimension, scratch);
+        }
+
+        mergeHeads(o, seqLength, w.heads, headDimension, projected);
+
+        y.resize(x.size());
+
+        project(projected.data(), w.output.data(), y.data(), seqLength, w.dModel, w.dModel);
+    }
+
+
+
+    static long statusKilobytes(const std::string &field) {
+
+        std::ifstream statusFile("/proc/self/status");
+
+        std::string line;
+
+        while (std::getline(statusFile, line)) {
+
+            if (line.starts_with(field)) {
+                return std::stol(line.substr(field.size() + 1));
+            }
+        }
+
+        return -1;
+    }
+
+
+    static long peakMemoryKilobytes(const std::function<void()> &run) {
+
+        malloc_trim(0);
+
+        const long before = statusKilobytes("VmRSS");
+
+        std::ofstream("/proc/self/clear_refs") << "5";
+
+        run();
+
+        return statusKilobytes("VmHWM") - before;
+    }
+
+
+    static void benchmark(const int &maxLength) {
+
+        constexpr int dModel = 512;
+
+        constexpr int heads = 8;
+
+        constexpr int headDimension = dModel / heads;
+
+
+        std::mt19937 rng(42);
+
+        parameterPool pool;
+
+        tensor<float> embeddings;
+
+        vocabularyImage vocabulary;
+
+        vocabularyImage::load(vocabulary);
+
+        std::ifstream embeddingsFileIn("../output/embeddings.bin", std::ios::binary);
+
+        if (embeddingsFileIn) {
+            embedding::loadEmbeddings(embeddingsFileIn, dModel, vocabulary.size(), pool, embeddings);
+        }
+
+        else {
+
+            std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+            embeddings = pool.allocateRows<float>(vocabulary.size(), dModel);
+
+            for (int i = 0; i < vocabulary.size(); i++) {
+                for (int j = 0; j < dModel; j++) {
+                    embeddings(i, j) = dist(rng);
+                }
+            }
+        }
+
+        weights w;
+
+        initializeWeights(w, dModel, heads, rng);
+
+        std::uniform_int_distribution tokenDist(0, vocabulary.size() - 1);
+
+        std::cout << "seq_len,naive_tokens_per_s,tiled_tokens_per_s,speedup,naive_peak_kb,tiled_peak_kb,max_abs_diff\n";
+
+        for (int seqLength = 128; seqLength <= maxLength; seqLength *= 2) {
+
+            std::vector<int> tokens(seqLength);
+
+            for (auto& i : tokens) {
+                i = tokenDist(rng);
+            }
+
+            std::vector<float> x;
+
+            gatherEmbeddings(tokens, embeddings, dModel, x);
+
+            std::vector<float> projected(x.size()), q, k, v;
+
+            project(x.data(), w.query.data(), projected.data(), seqLength, dModel, dModel);
+
+            splitHeads(projected, seqLength, heads, headDimension, q);
+
+            project(x.data(), w.key.data(), projected.data(), seqLength, dModel, dModel);
+
+            splitHeads(projected, seqLength, heads, headDimension, k);
+
+            project(x.data(), w.value.data(), projected.data(), seqLength, dModel, dModel);
+
+            splitHeads(projected, seqLength, heads, headDimension, v);
+
+
+            std::vector<float> naiveOutput, tiledOutput, scratch;
+
+            auto time = [&](const auto &run) {
+
+                const auto start = std::chrono::high_resolution_clock::now();
+
+                run();
+
+                const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+                return seqLength / elapsed.count();
+            };
+
+            const double naiveRate = time([&] { naiveAttention(q, k, v, naiveOutput, seqLength, heads, headDimension, scratch); });
+
+            scratch = std::vector<float>();
+
+            const double tiledRate = time([&] { flashAttention(q, k, v, tiledOutput, seqLength, heads, headDimension, scratch); });
+
+            float maxDifference = 0;
+
+            for (size_t i = 0; i < naiveOutput.size(); i++) {
+                maxDifference = std::max(maxDifference, std::abs(naiveOutput[i] - tiledOutput[i]));
+            }
+
+            naiveOutput = std::vector<float>();
+
+            tiledOutput = std::vector<float>();
+
+            scratch = std::vector<float>();
+
+            const long naivePeak = peakMemoryKilobytes([&] { naiveAttention(q, k, v, naiveOutput, seqLength, heads, headDimension, scratch); });
+
+            const long tiledPeak = peakMemoryKilobytes([&] { flashAttention(q, k, v, tiledOutput, seqLength, heads, headDimension, scratch); });
+
+            std::cout << seqLength << "," << naiveRate << "," << tiledRate << "," << tiledRate / naiveRate << ","
+            << naivePeak << "," << tiledPeak << "," << maxDifference << "\n";
+        }
+    }
+};
+
+
+
+
+#endif //ATTENTION_H
@@ -0,0 +1,640 @@
+#ifndef DATALOADER_H
+#define DATALOADER_H
+
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "embedding.h"
+#include "feedForward.h"
+#include "vocabularyImage.h"
+
+
+class dataLoader {
+public:
+
+    static constexpr char magic[8] = {'S', 'W', 'G', 'T', 'O', 'K', 'E', 'N'};
+
+    static constexpr std::uint32_t version = 1;
+
+    static constexpr size_t pageBytes = 4096;
+
+
+
+    struct header {
+
+        char magic[8];
+
+        std::uint32_t version;
+
+        std::uint32_t reserved;
+
+        std::uint64_t tokenCount;
+
+        std::uint64_t documentCount;
+
+        std::uint64_t tokensOffset;
+
+        std::uint64_t documentsOffset;
+
+        std::uint64_t fileBytes;
+    };
+
+
+    struct stream {
+
+        const std::int32_t* tokens = nullptr;
+
+        std::uint64_t tokenCount = 0;
+
+        const std::uint64_t* documentStarts = nullptr;
+
+        std::uint64_t documentCount = 0;
+
+        void* mapped = nullptr;
+
+        size_t mappedBytes = 0;
+    };
+
+
+    struct batch {
+
+        std::int64_t index = -1;
+
+        std::vector<const std::int32_t*> windows;
+
+        std::vector<std::uint16_t> segments;
+    };
+
+
+
+    static void writeStream(const std::function<bool(std::vector<int> &)> &nextDocument, std::ofstream &streamFile) {
+
+        header h{};
+
+        std::memcpy(h.magic, magic, sizeof(magic));
+
+        h.version = version;
+
+        h.tokensOffset = vocabularyImage::align(sizeof(header));
+
+        streamFile.seekp(static_cast<std::streamoff>(h.tokensOffset));
+
+        std::vector<std::uint64_t> documentStarts;
+
+        std::vector<int> document;
+
+        while (nextDocument(document)) {
+
+            if (document.empty()) {
+                continue;
+            }
+
+            documentStarts.push_back(h.tokenCount);
+
+            streamFile.write(reinterpret_cast<const char*>(document.data()), static_cast<std::streamsize>(document.size() * sizeof(std::int32_t)));
+
+            h.tokenCount += document.size();
+        }
+
+        h.documentCount = documentStarts.size();
+
+        h.documentsOffset = vocabularyImage::align(h.tokensOffset + h.tokenCount * sizeof(std::int32_t));
+
+        h.fileBytes = h.documentsOffset + h.documentCount * sizeof(std::uint64_t);
+
+        streamFile.seekp(static_cast<std::streamoff>(h.documentsOffset));
+
+        streamFile.write(reinterpret_cast<const char*>(documentStarts.data()), static_cast<std::streamsize>(documentStarts.size() * sizeof(std::uint64_t)));
+
+        streamFile.seekp(0);
+
+        streamFile.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    }
+
+
+    static void compile(const std::function<bool(std::vector<int> &)> &nextDocument, const std::string &streamPath) {
+
+        std::string temporaryPath = streamPath + ".XXXXXX";
+
+        const int fd = mkstemp(temporaryPath.data());
+
+        if (fd < 0) {
+            throw std::runtime_error("dataLoader : cannot create a temporary file next to " + streamPath);
+        }
+
+        fchmod(fd, 0644);
+
+        close(fd);
+
+        std::ofstream streamFile(temporaryPath, std::ios::binary);
+
+        try {
+            writeStream(nextDocument, streamFile);
+        }
+
+        catch (...) {
+
+            unlink(temporaryPath.c_str());
+
+            throw;
+        }
+
+        streamFile.close();
+
+        if (!streamFile) {
+
+            unlink(temporaryPath.c_str());
+
+            throw std::runtime_error("dataLoader : cannot write " + temporaryPath);
+        }
+
+        std::filesystem::rename(temporaryPath, streamPath);
+    }
+
+
+    static void compileCorpus(const std::string &corpusPath, const std::string &streamPath) {
+
+        vocabularyImage vocabulary;
+
+        vocabularyImage::load(vocabulary);
+
+        std::ifstream corpusFile(corpusPath);
+
+        std::vector<std::string> words;
+
+        compile([&](std::vector<int> &document) {
+
+            words.clear();
+
+            document.clear();
+
+            const bool more = embedding::loadWords(words, corpusFile);
+
+            vocabularyImage::tokenizeWords(words, vocabulary, document);
+
+            return more || !document.empty();
+        }, streamPath);
+
+        vocabularyImage::unmap(vocabulary);
+    }
+
+
+    static void map(const std::string &streamPath, stream &s) {
+
+        const int fd = open(streamPath.c_str(), O_RDONLY);
+
+        if (fd < 0) {
+            throw std::runtime_error("dataLoader : cannot open " + streamPath);
+        }
+
+        struct stat status{};
+
+        fstat(fd, &status);
+
+        const size_t bytes = status.st_size;
+
+        void* mapped = bytes >= sizeof(header) ? mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+
+        close(fd);
+
+        if (mapped == MAP_FAILED) {
+            throw std::runtime_error("dataLoader : cannot map " + streamPath);
+        }
+
+        const auto* h = static_cast<const header*>(mapped);
+
+        if (std::memcmp(h->magic, magic, sizeof(magic)) != 0 || h->version != version || h->fileBytes != bytes) {
+
+            munmap(mapped, bytes);
+
+            throw std::runtime_error("dataLoader : " + streamPath + " is not a token stream");
+        }
+
+        const char* base = static_cast<const char*>(mapped);
+
+        s.tokens = reinterpret_cast<const std::int32_t*>(base + h->tokensOffset);
+
+        s.tokenCount = h->tokenCount;
+
+        s.documentStarts = reinterpret_cast<const std::uint64_t*>(base + h->documentsOffset);
+
+        s.documentCount = h->documentCount;
+
+        s.mapped = mapped;
+
+        s.mappedBytes = bytes;
+    }
+
+
+    static void unmap(stream &s) {
+
+        if (s.mapped != nullptr) {
+            munmap(s.mapped, s.mappedBytes);
+        }
+
+        s = stream();
+    }
+
+
+
+    const stream &data;
+
+    const int batchSize;
+
+    const int seqLength;
+
+    const std::uint64_t seed;
+
+    const std::int64_t windowCount;
+
+    const std::int64_t batchesPerEpoch;
+
+    std::vector<batch> slots;
+
+    std::vector<std::uint32_t> orders[2];
+
+    std::int64_t orderEpochs[2] = {-1, -1};
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+
+    std::condition_variable produced;
+
+    std::condition_variable released;
+
+    std::atomic<std::int64_t> nextToProduce = 0;
+
+    std::int64_t nextToConsume = 0;
+
+    bool stopping = false;
+
+
+
+    dataLoader(const stream &data, const int &batchSize, const int &seqLength, const std::uint64_t &seed, const int &prefetchThreads, const int &prefetchBatches)
+    : data(data),
+    batchSize(batchSize),
+    seqLength(seqLength),
+    seed(seed),
+    windowCount(data.tokenCount > 0 ? static_cast<std::int64_t>((data.tokenCount - 1) / seqLength) : 0),
+    batchesPerEpoch(windowCount / batchSize) {
+
+        if (batchesPerEpoch == 0) {
+            throw std::runtime_error("dataLoader : the token stream is smaller than one batch");
+        }
+
+        slots.resize(std::clamp<std::int64_t>(prefetchBatches, 1, batchesPerEpoch));
+
+        for (auto& i : slots) {
+
+            i.windows.resize(batchSize);
+
+            i.segments.resize(static_cast<size_t>(batchSize) * (seqLength + 1));
+        }
+
+        for (int i = 0; i < std::max(1, prefetchThreads); i++) {
+
+            workers.emplace_back([this] { produce(); });
+        }
+    }
+
+
+    ~dataLoader() {
+
+        {
+            std::lock_guard lock(mutex);
+
+            stopping = true;
+        }
+
+        released.notify_all();
+
+        for (auto& i : workers) {
+            i.join();
+        }
+    }
+
+
+
+    const std::vector<std::uint32_t> &windowOrder(const std::int64_t &epoch) {
+
+        std::lock_guard lock(mutex);
+
+        std::vector<std::uint32_t> &order = orders[epoch % 2];
+
+        if (orderEpochs[epoch % 2] != epoch) {
+
+            order.resize(windowCount);
+
+            for (std::int64_t i = 0; i < windowCount; i++) {
+                order[i] = static_cast<std::uint32_t>(i);
+            }
+
+            std::mt19937_64 rng(seed + static_cast<std::uint64_t>(epoch) * 0x9E3779B97F4A7C15ull);
+
+            std::shuffle(order.begin(), order.end(), rng);
+
+            orderEpochs[epoch % 2] = epoch;
+        }
+
+        return order;
+    }
+
+
+    void fill(batch &b, const std::int64_t &index) {
+
+        const std::vector<std::uint32_t> &order = windowOrder(index / batchesPerEpoch);
+
+        const std::int64_t first = (index % batchesPerEpoch) * batchSize;
+
+        for (int w = 0; w < batchSize; w++) {
+
+            const std::uint64_t start = static_cast<std::uint64_t>(order[first + w]) * seqLength;
+
+            const std::uint64_t end = start + seqLength + 1;
+
+            b.windows[w] = data.tokens + start;
+
+            std::uint16_t* segments = b.segments.data() + static_cast<size_t>(w) * (seqLength + 1);
+
+            const std::uint64_t* document = std::upper_bound(data.documentStarts, data.documentStarts + data.documentCount, start);
+
+            std::uint16_t segment = 0;
+
+            for (std::uint64_t position = start; position < end; position++) {
+
+                if (document != data.documentStarts + data.documentCount && *document == position) {
+
+                    segment += position != start;
+
+                    document++;
+                }
+
+                segments[position - start] = segment;
+            }
+
+            const auto* firstPage = reinterpret_cast<const volatile char*>(reinterpret_cast<std::uintptr_t>(b.windows[w]) & ~(pageBytes - 1));
+
+            const auto* lastByte = reinterpret_cast<const char*>(data.tokens + end) - 1;
+
+            for (const volatile char* page = firstPage; page <= lastByte; page += pageBytes) {
+                (void) *page;
+            }
+        }
+    }
+
+
+    void produce() {
+
+        while (true) {
+
+            const std::int64_t index = nextToProduce++;
+
+            batch &b = slots[index % slots.size()];
+
+            {
+                std::unique_lock lock(mutex);
+
+                released.wait(lock, [&] { return stopping || nextToConsume >= index - static_cast<std::int64_t>(slots.size()) + 2; });
+
+                if (stopping) {
+                    return;
+                }
+            }
+
+            fill(b, index);
+
+            {
+                std::lock_guard lock(mutex);
+
+                b.index = index;
+            }
+
+            produced.notify_all();
+        }
+    }
+
+
+    const batch &next() {
+
+        std::unique_lock lock(mutex);
+
+        const std::int64_t index = nextToConsume++;
+
+        released.notify_all();
+
+        batch &b = slots[index % slots.size()];
+
+        produced.wait(lock, [&] { return b.index == index; });
+
+        return b;
+    }
+
+
+    static bool targetVisible(const batch &b, const int &window, const int &position, const int &seqLength) {
+
+        const std::uint16_t* segments = b.segments.data() + static_cast<size_t>(window) * (seqLength + 1);
+
+        return segments[position] == segments[position + 1];
+    }
+
+
+    static bool attentionVisible(const batch &b, const int &window, const int &query, const int &key, const int &seqLength) {
+
+        const std::uint16_t* segments = b.segments.data() + static_cast<size_t>(window) * (seqLength + 1);
+
+        return key <= query && segments[key] == segments[query];
+    }
+
+
+    static void benchmark(const int &batchSize, const int &seqLength) {
+
+        constexpr int dModel = 128;
+
+        constexpr int dHidden = 512;
+
+        constexpr int batches = 400;
+
+        std::string streamPath = "../output/tokens.bin";
+
+        vocabularyImage vocabulary;
+
+        vocabularyImage::load(vocabulary);
+
+        const int size = vocabulary.size();
+
+        if (!std::filesystem::exists(streamPath)) {
+
+            streamPath = "../output/tokens_synthetic.bin";
+
+            std::mt19937 rng(42);
+
+            std::uniform_int_distribution lengthDist(50, 2000);
+
+            std::uint64_t tokens = 0;
+
+            compile([&](std::vector<int> &document) {
+
+                if (tokens >= 32u << 20) {
+                    return false;
+                }
+
+                embedding::generateSyntheticArticle(document, lengthDist(rng), size, rng);
+
+                tokens += document.size();
+
+                return true;
+            }, streamPath);
+        }
+
+        stream s;
+
+        map(streamPath, s);
+
+        std::cout << streamPath << " : " << s.tokenCount << " tokens, " << s.documentCount << " documents\n";
+
+        const double tokensPerBatch = static_cast<double>(batchSize) * seqLength;
+
+
+        std::cout << "prefetch_threads,tokens_per_s\n";
+
+        for (const int threads : {1, 2, 4}) {
+
+            dataLoader loader(s, batchSize, seqLength, 42, threads, 8);
+
+            const auto start = std::chrono::high_resolution_clock::now();
+
+            std::uint64_t checksum = 0;
+
+            for (int i = 0; i < batches * 10; i++) {
+
+                const batch &b = loader.next();
+
+                checksum += static_cast<std::uint64_t>(b.windows[0][0]);
+            }
+
+            const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+            std::cout << threads << "," << batches * 10 * tokensPerBatch / elapsed.count() << "\n";
+        }
+
+
+        std::mt19937 rng(42);
+
+        std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+        parameterPool pool;
+
+        const tensor<float> embeddings = pool.allocateRows<float>(size, dModel);
+
+        for (int i = 0; i < size; i++) {
+            for (int j = 0; j < dModel; j++) {
+                embeddings(i, j) = dist(rng);
+            }
+        }
+
+        feedForward::weights w;
+
+        feedForward::initializeWeights(w, dModel, dHidden, gemm::activation::gelu, rng);
+
+        feedForward::activations a;
+
+        const int rows = batchSize * seqLength;
+
+        std::vector<float> x(static_cast<size_t>(rows) * dModel), y(x.size());
+
+        size_t visibleTargets = 0;
+
+        auto compute = [&](const batch &b) {
+
+            for (int window = 0; window < batchSize; window++) {
+                for (int i = 0; i < seqLength; i++) {
+
+                    std::copy_n(embeddings.row(b.windows[window][i]), dModel, x.data() + (static_cast<size_t>(window) * seqLength + i) * dModel);
+
+                    visibleTargets += targetVisible(b, window, i, seqLength);
+                }
+            }
+
+            feedForward::forward(w, x.data(), rows, a, y.data(), false);
+        };
+
+
+        std::chrono::duration<double> computeOnly{};
+
+        {
+            dataLoader loader(s, batchSize, seqLength, 42, 1, 1);
+
+            const batch &b = loader.next();
+
+            compute(b);
+
+            const auto start = std::chrono::high_resolution_clock::now();
+
+            for (int i = 0; i < batches; i++) {
+                compute(b);
+            }
+
+            computeOnly = std::chrono::high_resolution_clock::now() - start;
+        }
+
+        std::chrono::duration<double> waiting{};
+
+        std::chrono::duration<double> total{};
+
+        {
+            dataLoader loader(s, batchSize, seqLength, 42, 2, 8);
+
+            compute(loader.next());
+
+            const auto start = std::chrono::high_resolution_clock::now();
+
+            for (int i = 0; i < batches; i++) {
+
+                const auto waitStart = std::chrono::high_resolution_clock::now();
+
+                const batch &b = loader.next();
+
+                waiting += std::chrono::high_resolution_clock::now() - waitStart;
+
+                compute(b);
+            }
+
+            total = std::chrono::high_resolution_clock::now() - start;
+        }
+
+        std::cout << "compute only : " << batches * tokensPerBatch / computeOnly.count() << " tokens/s, "
+        << "with loader : " << batches * tokensPerBatch / total.count() << " tokens/s, "
+        << "time waiting for data : " << 100.0 * waiting.count() / total.count() << "%, "
+        << "visible targets : " << 100.0 * visibleTargets / ((2.0 * batches + 2) * tokensPerBatch) << "%\n";
+
+        unmap(s);
+
+        vocabularyImage::unmap(vocabulary);
+    }
+};
+
+
+
+
+#endif //DATALOADER_H
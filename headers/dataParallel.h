@@ -0,0 +1,574 @@
+#ifndef DATAPARALLEL_H
+#define DATAPARALLEL_H
+
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "embedding.h"
+
+
+class dataParallel {
+public:
+
+    struct sharedState {
+
+        std::atomic<std::uint64_t> iterations;
+    };
+
+
+
+    static void* mapShared(const size_t &bytes) {
+
+        void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+        if (memory == MAP_FAILED) {
+            throw std::runtime_error("dataParallel : cannot map shared memory");
+        }
+
+        return memory;
+    }
+
+
+    static int numaNodeCount() {
+
+        int count = 0;
+
+        while (std::filesystem::exists("/sys/devices/system/node/node" + std::to_string(count))) {
+            count++;
+        }
+
+        return std::max(count, 1);
+    }
+
+
+    static bool pinToNumaNode(const int &node) {
+
+        std::ifstream cpuListFile("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+
+        std::string cpuList;
+
+        if (!std::getline(cpuListFile, cpuList) || cpuList.empty()) {
+            return false;
+        }
+
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+
+        std::stringstream ranges(cpuList);
+
+        std::string range;
+
+        while (std::getline(ranges, range, ',')) {
+
+            const size_t dash = range.find('-');
+
+            const int first = std::stoi(range.substr(0, dash));
+
+            const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+
+            for (int cpu = first; cpu <= last; cpu++) {
+                CPU_SET(cpu, &cpus);
+            }
+        }
+
+        return sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+    }
+
+
+
+    static void copyFromShared(const float* shared, const tensor<float> &embeddings, const int &dimension) {
+
+        for (int i = 0; i < embeddings.shape[0]; i++) {
+
+            std::memcpy(embeddings.row(i), shared + static_cast<size_t>(i) * dimension, dimension * sizeof(float));
+        }
+    }
+
+
+    static void synchronize(
+        float* shared,
+        const tensor<float> &embeddings,
+        const tensor<float> &snapshot,
+        std::vector<std::uint8_t> &touchedRows,
+        const int &dimension) {
+
+        for (int i = 0; i < embeddings.shape[0]; i++) {
+
+            if (touchedRows[i] == 0) {
+                continue;
+            }
+
+            float* sharedRow = shared + static_cast<size_t>(i) * dimension;
+
+            for (int j = 0; j < dimension; j++) {
+
+                std::atomic_ref(sharedRow[j]).fetch_add(embeddings(i, j) - snapshot(i, j), std::memory_order_relaxed);
+            }
+
+            for (int j = 0; j < dimension; j++) {
+
+                const float merged = std::atomic_ref(sharedRow[j]).load(std::memory_order_relaxed);
+
+                embeddings(i, j) = merged;
+
+                snapshot(i, j) = merged;
+            }
+
+            touchedRows[i] = 0;
+        }
+    }
+
+
+
+    static void runWorker(
+        const int &rank,
+        float* shared,
+        sharedState* state,
+        const int &size,
+        const int &dimension,
+        const int &windowSize,
+        const int &negativeSamplesCount,
+        const float &learningRate,
+        const int &syncInterval,
+        const bool &numaPinning,
+        const std::function<bool(std::vector<int> &)> &loadArticle,
+        std::ofstream &lossesFile) {
+
+        if (numaPinning) {
+            pinToNumaNode(rank % numaNodeCount());
+        }
+
+        parameterPool pool;
+
+        const tensor<float> embeddings = pool.allocateRows<float>(size, dimension);
+
+        const tensor<float> snapshot = pool.allocateRows<float>(size, dimension);
+
+        copyFromShared(shared, embeddings, dimension);
+
+        copyFromShared(shared, snapshot, dimension);
+
+        arena scratch;
+
+        std::vector<std::uint8_t> touchedRows(size);
+
+        const embedding::trainStepFunction<float> trainStepKernel = embedding::trainStepGeneric<float>;
+
+        std::random_device dev;
+
+        std::mt19937 rng(dev() ^ static_cast<unsigned>(rank));
+
+        std::vector<int> tokenizedWords;
+
+        int articles = 0;
+
+        while (loadArticle(tokenizedWords)) {
+
+            size_t iterations = 0;
+
+            const float loss = embedding::trainArticle(
+                tokenizedWords,
+                embeddings,
+                trainStepKernel,
+                dimension,
+                windowSize,
+                negativeSamplesCount,
+                learningRate,
+                rng,
+                iterations,
+                scratch,
+                &touchedRows);
+
+            scratch.reset();
+
+            state->iterations += iterations;
+
+            lossesFile << loss / iterations << "\n";
+
+            articles++;
+
+            if (articles % syncInterval == 0) {
+                synchronize(shared, embeddings, snapshot, touchedRows, dimension);
+            }
+        }
+
+        synchronize(shared, embeddings, snapshot, touchedRows, dimension);
+    }
+
+
+    static void launchWorkers(const int &workers, const std::function<void(int)> &worker) {
+
+        if (workers < 1) {
+            throw std::runtime_error("dataParallel : at least one worker is needed");
+        }
+
+        std::cout.flush();
+
+        std::vector<pid_t> pids;
+
+        bool forkFailed = false;
+
+        for (int rank = 0; rank < workers; rank++) {
+
+            const pid_t pid = fork();
+
+            if (pid < 0) {
+
+                forkFailed = true;
+
+                break;
+            }
+
+            if (pid == 0) {
+
+                int code = 0;
+
+                try {
+                    worker(rank);
+                }
+
+                catch (const std::exception &e) {
+
+                    std::cerr << "dataParallel : worker " << rank << " failed : " << e.what() << "\n";
+
+                    code = 1;
+                }
+
+                catch (...) {
+
+                    std::cerr << "dataParallel : worker " << rank << " failed\n";
+
+                    code = 1;
+                }
+
+                std::cout.flush();
+
+                std::cerr.flush();
+
+                _exit(code);
+            }
+
+            pids.push_back(pid);
+        }
+
+        int failed = 0;
+
+        for (const auto& pid : pids) {
+
+            int status = 0;
+
+            pid_t waited;
+
+            do {
+                waited = waitpid(pid, &status, 0);
+            } while (waited < 0 && errno == EINTR);
+
+            if (waited < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                failed++;
+            }
+        }
+
+        if (forkFailed) {
+            throw std::runtime_error("dataParallel : fork failed after " + std::to_string(pids.size()) + " workers");
+        }
+
+        if (failed > 0) {
+            throw std::runtime_error("dataParallel : " + std::to_string(failed) + " of " + std::to_string(workers) + " workers failed");
+        }
+    }
+
+
+
+    static bool seekNextArticle(std::ifstream &corpusFile, const std::streamoff &end) {
+
+        std::string line;
+
+        while (true) {
+
+            const std::streamoff position = corpusFile.tellg();
+
+            if (position < 0 || position >= end || !std::getline(corpusFile, line)) {
+                return false;
+            }
+
+            if (line.find("<text") != std::string::npos) {
+
+                corpusFile.seekg(position);
+
+                return true;
+            }
+        }
+    }
+
+
+    static void embed(const int &workers, const int &syncInterval, const bool &numaPinning) {
+
+        if (workers < 1 || syncInterval < 1) {
+            throw std::runtime_error("dataParallel : workers and syncInterval must be at least 1");
+        }
+
+        constexpr int dimension = 512;
+
+        constexpr int windowSize = 5;
+
+        constexpr float learningRate = 0.0005f;
+
+        constexpr int negativeSamplesCount = 5;
+
+        constexpr int articles = 10000;
+
+        const std::string corpusPath = "/home/swann7777777/Documents/simplewiki-20250701-pages-articles-multistream.xml";
+
+
+
+        vocabularyImage vocabulary;
+
+        vocabularyImage::load(vocabulary);
+
+        const int size = vocabulary.size();
+
+
+
+        const std::string embeddingsPath = "../output/embeddings.bin";
+
+        const size_t tableBytes = static_cast<size_t>(size) * dimension * sizeof(float);
+
+        std::ifstream embeddingsFileIn(embeddingsPath, std::ios::binary);
+
+        if (!embeddingsFileIn) {
+            throw std::runtime_error("dataParallel : cannot open " + embeddingsPath);
+        }
+
+        std::error_code error;
+
+        if (const auto bytes = std::filesystem::file_size(embeddingsPath, error); error || bytes != tableBytes) {
+            throw std::runtime_error("dataParallel : " + embeddingsPath + " is not " + std::to_string(size) + " x " + std::to_string(dimension) + " floats");
+        }
+
+        auto* shared = static_cast<float*>(mapShared(tableBytes));
+
+        embeddingsFileIn.read(reinterpret_cast<char*>(shared), static_cast<std::streamsize>(tableBytes));
+
+        if (embeddingsFileIn.gcount() != static_cast<std::streamsize>(tableBytes)) {
+
+            munmap(shared, tableBytes);
+
+            throw std::runtime_error("dataParallel : short read of " + embeddingsPath);
+        }
+
+        embeddingsFileIn.close();
+
+        auto* state = new (mapShared(sizeof(sharedState))) sharedState{};
+
+
+
+        const std::streamoff corpusSize = static_cast<std::streamoff>(std::filesystem::file_size(corpusPath));
+
+        const auto start = std::chrono::high_resolution_clock::now();
+
+        launchWorkers(workers, [&](const int rank) {
+
+            const std::streamoff shardStart = corpusSize * rank / workers;
+
+            const std::streamoff shardEnd = corpusSize * (rank + 1) / workers;
+
+            std::ifstream corpusFile(corpusPath);
+
+            if (shardStart > 0) {
+
+                std::string line;
+
+                corpusFile.seekg(shardStart - 1);
+
+                std::getline(corpusFile, line);
+            }
+
+            std::ofstream lossesFile("../output/losses_worker" + std::to_string(rank) + ".csv");
+
+            std::vector<std::string> words;
+
+            int loaded = 0;
+
+            runWorker(rank, shared, state, size, dimension, windowSize, negativeSamplesCount, learningRate, syncInterval, numaPinning,
+                [&](std::vector<int> &tokenizedWords) {
+
+                    if (loaded >= (articles + workers - 1) / workers || !seekNextArticle(corpusFile, shardEnd)) {
+                        return false;
+                    }
+
+                    loaded++;
+
+                    words.clear();
+
+                    tokenizedWords.clear();
+
+                    embedding::loadWords(words, corpusFile);
+
+                    vocabularyImage::tokenizeWords(words, vocabulary, tokenizedWords);
+
+                    return true;
+                },
+                lossesFile);
+        });
+
+        const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+        std::cout << workers << " workers : " << state->iterations / elapsed.count() << " pairs/s\n";
+
+
+
+        std::ofstream embeddingsFileOut("../output/embeddings.bin", std::ios::binary);
+
+        embeddingsFileOut.write(reinterpret_cast<const char*>(shared), static_cast<std::streamsize>(size) * dimension * sizeof(float));
+
+        embeddingsFileOut.close();
+
+        munmap(shared, static_cast<size_t>(size) * dimension * sizeof(float));
+
+        munmap(state, sizeof(sharedState));
+    }
+
+
+
+    static float evaluateLoss(const float* shared, const int &size, const int &dimension, const int &windowSize, const int &negativeSamplesCount) {
+
+        parameterPool pool;
+
+        const tensor<float> embeddings = pool.allocateRows<float>(size, dimension);
+
+        copyFromShared(shared, embeddings, dimension);
+
+        arena scratch;
+
+        const embedding::trainStepFunction<float> trainStepKernel = embedding::trainStepGeneric<float>;
+
+        std::mt19937 rng(7);
+
+        std::vector<int> tokenizedWords;
+
+        float loss = 0;
+
+        size_t iterations = 0;
+
+        for (int a = 0; a < 8; a++) {
+
+            std::mt19937 articleRng(100000 + a);
+
+            embedding::generateSyntheticArticle(tokenizedWords, 1000, size, articleRng);
+
+            loss += embedding::trainArticle(tokenizedWords, embeddings, trainStepKernel, dimension, windowSize, negativeSamplesCount, 0.0f, rng, iterations, scratch);
+
+            scratch.reset();
+        }
+
+        return loss / iterations;
+    }
+
+
+    static void benchmarkScaling() {
+
+        constexpr int size = 30000;
+
+        constexpr int dimension = 512;
+
+        constexpr int windowSize = 5;
+
+        constexpr int negativeSamplesCount = 5;
+
+        constexpr float learningRate = 0.025f;
+
+        constexpr int articles = 64;
+
+        constexpr int syncInterval = 4;
+
+
+        std::vector<int> workerCounts = {1, 2, 4};
+
+        const int cores = static_cast<int>(std::thread::hardware_concurrency());
+
+        if (cores > 4) {
+            workerCounts.push_back(cores);
+        }
+
+        auto* shared = static_cast<float*>(mapShared(static_cast<size_t>(size) * dimension * sizeof(float)));
+
+        auto* state = new (mapShared(sizeof(sharedState))) sharedState{};
+
+        double baseline = 0;
+
+        std::cout << "workers,seconds,pairs_per_s,speedup,final_loss\n";
+
+        for (const int workers : workerCounts) {
+
+            std::mt19937 rng(42);
+
+            std::uniform_real_distribution<float> dist(-0.1f, 0.1f);
+
+            for (size_t i = 0; i < static_cast<size_t>(size) * dimension; i++) {
+
+                shared[i] = dist(rng);
+            }
+
+            state->iterations = 0;
+
+            const auto start = std::chrono::high_resolution_clock::now();
+
+            launchWorkers(workers, [&](const int rank) {
+
+                std::ofstream lossesFile;
+
+                int article = articles * rank / workers;
+
+                const int shardEnd = articles * (rank + 1) / workers;
+
+                runWorker(rank, shared, state, size, dimension, windowSize, negativeSamplesCount, learningRate, syncInterval, true,
+                    [&](std::vector<int> &tokenizedWords) {
+
+                        if (article >= shardEnd) {
+                            return false;
+                        }
+
+                        std::mt19937 articleRng(1000 + article);
+
+                        embedding::generateSyntheticArticle(tokenizedWords, 1000, size, articleRng);
+
+                        article++;
+
+                        return true;
+                    },
+                    lossesFile);
+            });
+
+            const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+            const double pairsPerSecond = state->iterations / elapsed.count();
+
+            if (baseline == 0) {
+                baseline = pairsPerSecond;
+            }
+
+            std::cout << workers << "," << elapsed.count() << "," << pairsPerSecond << "," << pairsPerSecond / baseline << ","
+            << evaluateLoss(shared, size, dimension, windowSize, negativeSamplesCount) << "\n";
+        }
+
+        munmap(shared, static_cast<size_t>(size) * dimension * sizeof(float));
+
+        munmap(state, sizeof(sharedState));
+    }
+};
+
+
+
+
+#endif //DATAPARALLEL_H
@@ -0,0 +1,400 @@
+#ifndef DETOKENIZER_H
+#define DETOKENIZER_H
+
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "embedding.h"
+#include "encoder.h"
+#include "tensor.h"
+#include "vocabularyImage.h"
+
+
+class detokenizer {
+public:
+
+    const char* pool = nullptr;
+
+    const std::uint64_t* offsets = nullptr;
+
+    int count = 0;
+
+    std::string ownedPool;
+
+    std::vector<std::uint64_t> ownedOffsets;
+
+
+
+    // Views returned by push and pending point into text (valid until the next push or consume).
+    struct stream {
+
+        std::string text;
+
+        size_t emitted = 0;
+
+        size_t tokens = 0;
+    };
+
+
+
+    int size() const {
+        return count;
+    }
+
+
+    std::string_view token(const int &index) const {
+        return {pool + offsets[index], static_cast<size_t>(offsets[index + 1] - offsets[index])};
+    }
+
+
+
+    static void fromImage(const vocabularyImage &image, detokenizer &d) {
+
+        d.ownedPool.clear();
+
+        d.ownedOffsets.clear();
+
+        d.pool = image.pool;
+
+        d.offsets = image.offsets;
+
+        d.count = image.size();
+    }
+
+
+    static void fromVocabulary(const std::vector<std::string> &vocabulary, detokenizer &d) {
+
+        size_t poolBytes = 0;
+
+        for (const auto& i : vocabulary) {
+            poolBytes += i.size();
+        }
+
+        d.ownedPool.clear();
+
+        d.ownedPool.reserve(poolBytes);
+
+        d.ownedOffsets.clear();
+
+        d.ownedOffsets.reserve(vocabulary.size() + 1);
+
+        for (const auto& i : vocabulary) {
+
+            d.ownedOffsets.push_back(d.ownedPool.size());
+
+            d.ownedPool += i;
+        }
+
+        d.ownedOffsets.push_back(d.ownedPool.size());
+
+        d.pool = d.ownedPool.data();
+
+        d.offsets = d.ownedOffsets.data();
+
+        d.count = static_cast<int>(vocabulary.size());
+    }
+
+
+
+    static size_t decodedLength(const detokenizer &d, const int* ids, const size_t &idCount, const std::string_view &separator = {}) {
+
+        size_t length = idCount > 0 ? (idCount - 1) * separator.size() : 0;
+
+        for (size_t i = 0; i < idCount; i++) {
+
+            if (static_cast<unsigned>(ids[i]) >= static_cast<unsigned>(d.count)) {
+                throw std::runtime_error("detokenizer : token id " + std::to_string(ids[i]) + " out of range");
+            }
+
+            length += d.offsets[ids[i] + 1] - d.offsets[ids[i]];
+        }
+
+        return length;
+    }
+
+
+    static size_t decodeInto(const detokenizer &d, const int* ids, const size_t &idCount, char* buffer, const std::string_view &separator = {}) {
+
+        char* out = buffer;
+
+        for (size_t i = 0; i < idCount; i++) {
+
+            if (i > 0 && !separator.empty()) {
+
+                std::memcpy(out, separator.data(), separator.size());
+
+                out += separator.size();
+            }
+
+            const std::uint64_t begin = d.offsets[ids[i]];
+
+            const size_t length = d.offsets[ids[i] + 1] - begin;
+
+            std::memcpy(out, d.pool + begin, length);
+
+            out += length;
+        }
+
+        return out - buffer;
+    }
+
+
+    static size_t decode(const detokenizer &d, const int* ids, const size_t &idCount, char* buffer, const size_t &capacity, const std::string_view &separator = {}) {
+
+        const size_t length = decodedLength(d, ids, idCount, separator);
+
+        if (length > capacity) {
+            throw std::runtime_error("detokenizer : buffer of " + std::to_string(capacity) + " bytes too small for " + std::to_string(length));
+        }
+
+        return decodeInto(d, ids, idCount, buffer, separator);
+    }
+
+
+    static void decode(const detokenizer &d, const std::vector<int> &ids, std::string &text, const std::string_view &separator = {}) {
+
+        text.resize(decodedLength(d, ids.data(), ids.size(), separator));
+
+        decodeInto(d, ids.data(), ids.size(), text.data(), separator);
+    }
+
+
+
+    static std::string_view push(const detokenizer &d, stream &s, const int &id, const std::string_view &separator = {}) {
+
+        if (static_cast<unsigned>(id) >= static_cast<unsigned>(d.count)) {
+            throw std::runtime_error("detokenizer : token id " + std::to_string(id) + " out of range");
+        }
+
+        const size_t start = s.text.size();
+
+        if (s.tokens > 0) {
+            s.text += separator;
+        }
+
+        s.text += d.token(id);
+
+        s.tokens++;
+
+        return std::string_view(s.text).substr(start);
+    }
+
+
+    static std::string_view pending(stream &s) {
+
+        const std::string_view text = std::string_view(s.text).substr(s.emitted);
+
+        s.emitted = s.text.size();
+
+        return text;
+    }
+
+
+    static void consume(stream &s) {
+
+        s.text.erase(0, s.emitted);
+
+        s.emitted = 0;
+    }
+
+
+    static void reset(stream &s) {
+
+        s.text.clear();
+
+        s.emitted = 0;
+
+        s.tokens = 0;
+    }
+
+
+
+    static void readTokens(const std::string &path, std::vector<int> &ids) {
+
+        std::ifstream file(path, std::ios::binary);
+
+        if (!file) {
+            throw std::runtime_error("detokenizer : cannot open " + path);
+        }
+
+        const std::vector<std::uint8_t> encoded((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        const std::uint8_t* position = encoded.data();
+
+        std::uint32_t token;
+
+        ids.clear();
+
+        while (position < encoded.data() + encoded.size() && encoder::readVarint(position, encoded.data() + encoded.size(), token)) {
+            ids.push_back(static_cast<int>(token));
+        }
+    }
+
+
+    static void benchmark(const std::string &tokensPath) {
+
+        constexpr size_t chunkTokens = 4096;
+
+        constexpr int repeats = 3;
+
+        vocabularyImage image;
+
+        vocabularyImage::load(image);
+
+        detokenizer d;
+
+        fromImage(image, d);
+
+        std::vector<std::string> vocabulary;
+
+        std::ifstream vocabularyFile("../output/vocabulary.txt");
+
+        embedding::loadVocabulary(vocabularyFile, vocabulary);
+
+        std::vector<int> ids;
+
+        if (!tokensPath.empty()) {
+            readTokens(tokensPath, ids);
+        }
+
+        else {
+
+            std::mt19937 rng(42);
+
+            std::uniform_int_distribution<int> distribution(0, d.size() - 1);
+
+            ids.resize(size_t{1} << 24);
+
+            for (auto& i : ids) {
+                i = distribution(rng);
+            }
+        }
+
+        const size_t total = ids.size();
+
+        std::cout << "tokens : " << total << (tokensPath.empty() ? " (uniform random ids)" : " from " + tokensPath) << "\n";
+
+        std::cout << "method,chunk_tokens,tokens_per_s,mb_per_s,allocations_per_call\n";
+
+        auto measure = [&](const std::string &name, const size_t &chunk, const auto &call) {
+
+            double best = 1e30;
+
+            size_t bytes = 0;
+
+            std::uint64_t allocations = 0;
+
+            size_t calls = 0;
+
+            for (int r = 0; r < repeats; r++) {
+
+                bytes = 0;
+
+                calls = 0;
+
+                const std::uint64_t allocationsBefore = allocationCounter::count();
+
+                const auto start = std::chrono::high_resolution_clock::now();
+
+                for (size_t i = 0; i < total; i += chunk) {
+
+                    bytes += call(ids.data() + i, std::min(chunk, total - i));
+
+                    calls++;
+                }
+
+                const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+                allocations = allocationCounter::count() - allocationsBefore;
+
+                best = std::min(best, elapsed.count());
+            }
+
+            std::cout << name << "," << chunk << "," << total / best << "," << bytes / best / (1024 * 1024) << ","
+            << static_cast<double>(allocations) / std::max<size_t>(calls, 1) << "\n";
+        };
+
+        std::string text;
+
+        for (const size_t chunk : {chunkTokens, total}) {
+
+            measure("strings", chunk, [&](const int* chunkIds, const size_t &n) {
+
+                std::string out;
+
+                for (size_t i = 0; i < n; i++) {
+                    out += vocabulary[chunkIds[i]];
+                }
+
+                return out.size();
+            });
+
+            measure("pool", chunk, [&](const int* chunkIds, const size_t &n) {
+
+                std::string out;
+
+                out.resize(decodedLength(d, chunkIds, n));
+
+                return decodeInto(d, chunkIds, n, out.data());
+            });
+
+            size_t longest = 0;
+
+            for (size_t i = 0; i < total; i += chunk) {
+                longest = std::max(longest, decodedLength(d, ids.data() + i, std::min(chunk, total - i)));
+            }
+
+            text.resize(longest);
+
+            measure("pool_buffer", chunk, [&](const int* chunkIds, const size_t &n) {
+                return decode(d, chunkIds, n, text.data(), text.size());
+            });
+        }
+
+        stream s;
+
+        s.text.reserve(2 << 20);
+
+        measure("stream", 1, [&](const int* chunkIds, const size_t &) {
+
+            push(d, s, chunkIds[0]);
+
+            const size_t length = pending(s).size();
+
+            consume(s);
+
+            return length;
+        });
+
+        reset(s);
+
+        std::string reference;
+
+        for (const auto& i : ids) {
+            reference += vocabulary[i];
+        }
+
+        std::string decoded;
+
+        decode(d, ids, decoded);
+
+        std::cout << "check : pool decode " << (decoded == reference ? "matches" : "differs from") << " the vocabulary.txt strings (" << reference.size() << " bytes)\n";
+
+        vocabularyImage::unmap(image);
+    }
+};
+
+
+
+
+#endif //DETOKENIZER_H
@@ -5,6 +5,19 @@
 #include <cmath>
 #include <random>
 #include <numeric>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "tensor.h"
+#include "vocabularyImage.h"
 
 
 class embedding {
@@ -156,58 +169,98 @@ public:
     }
 
 
+    static void splitWords(const std::string_view &text, std::vector<std::string> &words) {
+
+        std::string word;
+
+        for (const char i : text) {
+
+            const unsigned char c = i;
+
+            if (std::isalpha(c)) {
+                word += static_cast<char>(std::tolower(c));
+            }
+
+            else if (!word.empty()) {
+                words.push_back(word);
+                word.clear();
+            }
+        }
+
+        if (!word.empty()) {
+            words.push_back(word);
+        }
+    }
+
+
     static void tokenizeWords(const std::vector<std::string> &words,
     const trieNode* root,
     std::vector<int> &tokenizedWords) {
 
         for (const auto& word : words) {
 
-            const trieNode* node = root;
+            for (size_t start = 0; start < word.size();) {
+
+                const trieNode* node = root;
 
-            int index = 0;
-            int token = -1;
+                int token = -1;
 
-            for (int i = 0; i < word.size();) {
+                size_t end = start + 1;
 
-                if (node->children[word[i] - 'a'] != nullptr) {
+                for (size_t i = start; i < word.size(); i++) {
 
                     node = node->children[word[i] - 'a'];
 
+                    if (node == nullptr) {
+                        break;
+                    }
+
                     if (node->index != -1) {
 
                         token = node->index;
-                        index = i;
-                    }
 
-                    i++;
+                        end = i + 1;
+                    }
                 }
 
-                else {
-
+                if (token >= 0) {
                     tokenizedWords.push_back(token);
-                    i = index + 1;
-                    node = root;
                 }
-            }
 
-            tokenizedWords.push_back(token);
+                start = end;
+            }
         }
     }
 
 
-    static void loadEmbeddings(std::ifstream &embeddingsFileIn, const int &dimension, const int &size, std::vector<std::vector<float>> &embeddings) {
+    template<typename T>
+    static void loadEmbeddings(std::ifstream &embeddingsFileIn, const int &dimension, const int &size, parameterPool &pool, tensor<T> &embeddings) {
 
-        embeddings.resize(size);
+        embeddings = pool.allocateRows<T>(size, dimension);
 
-        for (auto& i : embeddings) {
+        std::vector<float> row(dimension);
 
-            i.resize(dimension);
-        }
+        std::uint32_t state = roundingState();
+
+        for (int i = 0; i < size; i++) {
+
+            embeddingsFileIn.read(reinterpret_cast<char*>(row.data()), dimension * sizeof(float));
 
-        for (auto& i : embeddings) {
+            if (embeddingsFileIn.gcount() != static_cast<std::streamsize>(dimension * sizeof(float))) {
+                throw std::runtime_error("embedding : embeddings file ends at row " + std::to_string(i) + " of " + std::to_string(size));
+            }
+
+            const std::uint32_t seed = nextSeed(state);
 
-            embeddingsFileIn.read(reinterpret_cast<char*>(i.data()), dimension * sizeof(float));
+            T* embedding = embeddings.row(i);
+
+            for (int j = 0; j < dimension; j++) {
+
+                store(embedding[j], row[j], roundingNoise(seed, j));
+            }
         }
+
+        roundingState() = state;
     }
 
 
@@ -244,257 +297,905 @@ public:
 
     static void forwardPass(
         float &positiveError,
-        std::vector<float> &negativeErrors,
-        const std::vector<float> &centreEmbedding,
-        const std::vector<float> &contextEmbedding,
-        const std::vector<int> &negativeIndices,
-        const std::vector<std::vector<float>> &embeddings) {
+        const tensor<float> &negativeErrors,
+        const tensor<float> &centreEmbedding,
+        const tensor<float> &contextEmbedding,
+        const tensor<int> &negativeIndices,
+        const tensor<float> &embeddings,
+        arena &scratch) {
 
 
+        const arena::marker mark = scratch.mark();
 
-        std::vector<float> negativeSamplesDotProducts(negativeIndices.size());
+        const tensor<float> negativeSamplesDotProducts = scratch.allocate<float>({negativeIndices.shape[0]});
 
-        const float positiveSampleDotProduct = std::inner_product(contextEmbedding.begin(),
-            contextEmbedding.end(),
-            centreEmbedding.begin(),
+        const float positiveSampleDotProduct = std::inner_product(contextEmbedding.data,
+            contextEmbedding.data + contextEmbedding.shape[0],
+            centreEmbedding.data,
             0.0f);
 
         positiveError = sigmoid(positiveSampleDotProduct);
 
-        for (int i = 0; i < negativeIndices.size(); i++) {
+        for (int i = 0; i < negativeIndices.shape[0]; i++) {
 
-            negativeSamplesDotProducts[i] = std::inner_product(embeddings[negativeIndices[i]].begin(),
-                embeddings[negativeIndices[i]].end(),
-                centreEmbedding.begin(),
+            negativeSamplesDotProducts(i) = std::inner_product(embeddings.row(negativeIndices(i)),
+                embeddings.row(negativeIndices(i)) + embeddings.shape[1],
+                centreEmbedding.data,
                 0.0f);
 
         }
 
-        for (int i = 0; i < negativeSamplesDotProducts.size(); i++) {
+        for (int i = 0; i < negativeSamplesDotProducts.shape[0]; i++) {
 
-            negativeErrors[i] = sigmoid(-negativeSamplesDotProducts[i]);
+            negativeErrors(i) = sigmoid(-negativeSamplesDotProducts(i));
         }
+
+        scratch.rewind(mark);
     }
 
 
     static void backpropagation(
-        std::vector<float> &centreEmbedding,
-        std::vector<float> &contextEmbedding,
+        const tensor<float> &centreEmbedding,
+        const tensor<float> &contextEmbedding,
         const float &learningRate,
-        const std::vector<int> &negativeIndices,
-        std::vector<std::vector<float>> &embeddings,
+        const tensor<int> &negativeIndices,
+        const tensor<float> &embeddings,
         const float &positiveError,
-        const std::vector<float> &negativeErrors) {
+        const tensor<float> &negativeErrors,
+        arena &scratch) {
+
+
+        const arena::marker mark = scratch.mark();
 
+        const std::int64_t dimension = centreEmbedding.shape[0];
 
-        std::vector<float> centreSignal(contextEmbedding.size());
-        std::vector<float> contextSignal(centreEmbedding.size());
-        std::vector<std::vector<float>> negativeSignals(negativeIndices.size());
+        const tensor<float> centreSignal = scratch.allocate<float>({dimension});
+        const tensor<float> contextSignal = scratch.allocate<float>({dimension});
+        const tensor<float> negativeSignals = scratch.allocate<float>({negativeIndices.shape[0], dimension});
 
-        for (auto& i : negativeSignals) {
 
-            i.resize(centreEmbedding.size());
+        for (int i = 0; i < dimension; i++) {
+
+            centreSignal(i) = (positiveError - 1) * contextEmbedding(i);
         }
 
+        for (int i = 0; i < negativeIndices.shape[0]; i++) {
+            for (int j = 0; j < dimension; j++) {
+
+                centreSignal(j) += (1 - negativeErrors(i)) * embeddings(negativeIndices(i), j);
+            }
+        }
 
-        for (int i = 0; i < contextEmbedding.size(); i++) {
+        for (int i = 0; i < dimension; i++) {
 
-            centreSignal[i] = (positiveError - 1) * contextEmbedding[i];
+            contextSignal(i) = (positiveError - 1) * centreEmbedding(i);
         }
 
-        for (int i = 0; i < negativeIndices.size(); i++) {
-            for (int j = 0; j < embeddings[negativeIndices[i]].size(); j++) {
 
-                centreSignal[j] += (1 - negativeErrors[i]) * embeddings[negativeIndices[i]][j];
+        for (int i = 0; i < negativeIndices.shape[0]; i++) {
+
+            for (int j = 0; j < dimension; j++) {
+
+                negativeSignals(i, j) = (1 - negativeErrors(i)) * centreEmbedding(j);
             }
+
+            for (int j = 0; j < dimension; j++) {
+
+                embeddings(negativeIndices(i), j) -= negativeSignals(i, j) * learningRate;
+            }
+        }
+
+        for (int i = 0; i < dimension; i++) {
+
+            centreEmbedding(i) -= centreSignal(i) * learningRate;
         }
 
-        for (int i = 0; i < centreEmbedding.size(); i++) {
+        for (int i = 0; i < dimension; i++) {
 
-            contextSignal[i] = (positiveError - 1) * centreEmbedding[i];
+            contextEmbedding(i) -= contextSignal(i) * learningRate;
         }
 
+        scratch.rewind(mark);
+    }
+
+
+
+    struct bfloat16 {
+
+        std::uint16_t bits;
+    };
+
+
+    static float toFloat(const float x) {
+        return x;
+    }
+
+
+    static float toFloat(const bfloat16 x) {
+        return std::bit_cast<float>(static_cast<std::uint32_t>(x.bits) << 16);
+    }
+
+
+    static std::uint32_t nextSeed(std::uint32_t &state) {
+
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+
+        return state;
+    }
+
+
+    static std::uint32_t roundingNoise(const std::uint32_t seed, const int i) {
+        return (seed + static_cast<std::uint32_t>(i) * 0x9E3779B9u) >> 16;
+    }
+
+
+    static void store(float &x, const float value, const std::uint32_t) {
+        x = value;
+    }
+
+
+    static void store(bfloat16 &x, const float value, const std::uint32_t noise) {
+        x.bits = static_cast<std::uint16_t>((std::bit_cast<std::uint32_t>(value) + noise) >> 16);
+    }
+
 
-        for (int i = 0; i < negativeIndices.size(); i++) {
+    static std::uint32_t &roundingState() {
 
-            for (int j = 0; j < centreEmbedding.size(); j++) {
+        thread_local std::uint32_t state = 0x9E3779B9u ^ static_cast<std::uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id()));
 
-                negativeSignals[i][j] = (1 - negativeErrors[i]) * centreEmbedding[j];
+        return state;
+    }
+
+
+
+    template<typename T>
+    using trainStepFunction = float (*)(
+        T* centreEmbedding,
+        T* contextEmbedding,
+        T* const* negativeEmbeddings,
+        const int &dimension,
+        const int &negativeSamplesCount,
+        const float &learningRate,
+        arena &scratch);
+
+
+
+    template<typename T>
+    static float dotProduct(const T* a, const float* b, const int &dimension) {
+
+        float sums[8]{};
+
+        int i = 0;
+
+        for (; i + 8 <= dimension; i += 8) {
+            for (int j = 0; j < 8; j++) {
+
+                sums[j] += toFloat(a[i + j]) * b[i + j];
             }
+        }
+
+        for (; i < dimension; i++) {
+
+            sums[0] += toFloat(a[i]) * b[i];
+        }
+
+        return ((sums[0] + sums[1]) + (sums[2] + sums[3])) + ((sums[4] + sums[5]) + (sums[6] + sums[7]));
+    }
+
+
+
+    template<int dimension, typename T>
+    static float dotProduct(const T* a, const float* b) {
+        return dotProduct(a, b, dimension);
+    }
+
+
+
+    template<typename T>
+    [[gnu::always_inline]] static float trainStepBody(
+        T* centreEmbedding,
+        T* contextEmbedding,
+        T* const* negativeEmbeddings,
+        const int dimension,
+        const int negativeSamplesCount,
+        const float learningRate,
+        float* centre,
+        float* centreSignal,
+        float* negativeCoefficients) {
+
+        std::uint32_t state = roundingState();
 
-            for (int j = 0; j < embeddings[negativeIndices[i]].size(); j++) {
+        for (int i = 0; i < dimension; i++) {
 
-                embeddings[negativeIndices[i]][j] -= negativeSignals[i][j] * learningRate;
+            centre[i] = toFloat(centreEmbedding[i]);
+        }
+
+        const float positiveError = sigmoid(dotProduct(contextEmbedding, centre, dimension));
+
+        const float positiveCoefficient = positiveError - 1;
+
+        float loss = -std::log(positiveError);
+
+        for (int k = 0; k < negativeSamplesCount; k++) {
+
+            const float negativeError = sigmoid(-dotProduct(negativeEmbeddings[k], centre, dimension));
+
+            negativeCoefficients[k] = 1 - negativeError;
+
+            loss += -std::log(negativeError);
+        }
+
+        for (int i = 0; i < dimension; i++) {
+
+            centreSignal[i] = positiveCoefficient * toFloat(contextEmbedding[i]);
+        }
+
+        for (int k = 0; k < negativeSamplesCount; k++) {
+
+            const float coefficient = negativeCoefficients[k];
+
+            const float step = coefficient * learningRate;
+
+            const std::uint32_t seed = nextSeed(state);
+
+            T* negativeEmbedding = negativeEmbeddings[k];
+
+            for (int i = 0; i < dimension; i++) {
+
+                const float negative = toFloat(negativeEmbedding[i]);
+
+                centreSignal[i] += coefficient * negative;
+
+                store(negativeEmbedding[i], negative - step * centre[i], roundingNoise(seed, i));
             }
         }
 
-        for (int i = 0; i < centreEmbedding.size(); i++) {
+        const std::uint32_t centreSeed = nextSeed(state);
+
+        for (int i = 0; i < dimension; i++) {
 
-            centreEmbedding[i] -= centreSignal[i] * learningRate;
+            store(centreEmbedding[i], toFloat(centreEmbedding[i]) - centreSignal[i] * learningRate, roundingNoise(centreSeed, i));
         }
 
-        for (int i = 0; i < contextEmbedding.size(); i++) {
+        const std::uint32_t contextSeed = nextSeed(state);
+
+        for (int i = 0; i < dimension; i++) {
 
-            contextEmbedding[i] -= contextSignal[i] * learningRate;
+            store(contextEmbedding[i], toFloat(contextEmbedding[i]) - positiveCoefficient * learningRate * centre[i], roundingNoise(contextSeed, i));
         }
+
+        roundingState() = state;
+
+        return loss;
+    }
+
+
+    template<typename T, int dimension, int negativeSamplesCount>
+    static float trainStep(
+        T* centreEmbedding,
+        T* contextEmbedding,
+        T* const* negativeEmbeddings,
+        const int &,
+        const int &,
+        const float &learningRate,
+        arena &) {
+
+        alignas(64) float centre[dimension];
+        alignas(64) float centreSignal[dimension];
+        float negativeCoefficients[negativeSamplesCount];
+
+        return trainStepBody(centreEmbedding, contextEmbedding, negativeEmbeddings, dimension, negativeSamplesCount, learningRate, centre, centreSignal, negativeCoefficients);
     }
 
 
+    template<typename T>
+    static float trainStepGeneric(
+        T* centreEmbedding,
+        T* contextEmbedding,
+        T* const* negativeEmbeddings,
+        const int &dimension,
+        const int &negativeSamplesCount,
+        const float &learningRate,
+        arena &scratch) {
+
+        const arena::marker mark = scratch.mark();
 
-    static void outputEmbeddings(const std::vector<std::vector<float>> &embeddings, std::ofstream &embeddingsFileOut) {
+        float* centre = scratch.allocateArray<float>(dimension);
+        float* centreSignal = scratch.allocateArray<float>(dimension);
+        float* negativeCoefficients = scratch.allocateArray<float>(negativeSamplesCount);
 
+        const float loss = trainStepBody(centreEmbedding, contextEmbedding, negativeEmbeddings, dimension, negativeSamplesCount, learningRate, centre, centreSignal, negativeCoefficients);
 
-        for (const auto& i : embeddings) {
+        scratch.rewind(mark);
 
-            embeddingsFileOut.write(reinterpret_cast<const char*>(i.data()), i.size() * sizeof(float));
+        return loss;
+    }
+
+
+    template<typename T, int dimension>
+    static trainStepFunction<T> trainStepSpecializedForDimension(const int &negativeSamplesCount) {
+
+        switch (negativeSamplesCount) {
+            case 5: return trainStep<T, dimension, 5>;
+            case 10: return trainStep<T, dimension, 10>;
+            case 15: return trainStep<T, dimension, 15>;
+            default: return trainStepGeneric<T>;
         }
     }
 
 
+    template<typename T>
+    static trainStepFunction<T> trainStepSpecialized(const int &dimension, const int &negativeSamplesCount) {
 
-    static void embed() {
+        switch (dimension) {
+            case 128: return trainStepSpecializedForDimension<T, 128>(negativeSamplesCount);
+            case 256: return trainStepSpecializedForDimension<T, 256>(negativeSamplesCount);
+            case 300: return trainStepSpecializedForDimension<T, 300>(negativeSamplesCount);
+            case 512: return trainStepSpecializedForDimension<T, 512>(negativeSamplesCount);
+            default: return trainStepGeneric<T>;
+        }
+    }
 
-        constexpr int dimension = 512;
 
-        constexpr int windowSize = 5;
+    static void benchmarkTrainSteps() {
+
+        constexpr int size = 30000;
+
+        constexpr int steps = 100000;
+
+        constexpr int repeats = 5;
 
         constexpr float learningRate = 0.0005f;
 
+        constexpr int dimensions[] = {128, 256, 300, 512};
+
+        constexpr int negativeSamplesCounts[] = {5, 10, 15};
+
+
+        std::mt19937 rng(42);
+
+        std::uniform_int_distribution indexDist(0, size - 1);
+
+        std::cout << "dimension,negatives,legacy_steps_per_s,generic_steps_per_s,specialized_steps_per_s,speedup_vs_generic,speedup_vs_legacy\n";
+
+        for (const int dimension : dimensions) {
+
+            std::uniform_real_distribution<float> dist(-0.5f / dimension, 0.5f / dimension);
+
+            parameterPool pool;
+
+            const tensor<float> embeddings = pool.allocateRows<float>(size, dimension);
+
+            for (int i = 0; i < size; i++) {
+                for (int j = 0; j < dimension; j++) {
+
+                    embeddings(i, j) = dist(rng);
+                }
+            }
+
+            arena scratch;
+
+            for (const int negativeSamplesCount : negativeSamplesCounts) {
+
+                std::vector<int> indices(static_cast<size_t>(steps) * (negativeSamplesCount + 2));
+
+                for (auto& i : indices) {
+
+                    i = indexDist(rng);
+                }
+
+
+                auto runKernel = [&](const trainStepFunction<float> kernel) {
+
+                    std::vector<float*> negativeEmbeddings(negativeSamplesCount);
+
+                    const auto start = std::chrono::high_resolution_clock::now();
+
+                    for (int s = 0; s < steps; s++) {
+
+                        const int* stepIndices = indices.data() + static_cast<size_t>(s) * (negativeSamplesCount + 2);
+
+                        for (int k = 0; k < negativeSamplesCount; k++) {
+
+                            negativeEmbeddings[k] = embeddings.row(stepIndices[k + 2]);
+                        }
+
+                        kernel(embeddings.row(stepIndices[0]), embeddings.row(stepIndices[1]), negativeEmbeddings.data(), dimension, negativeSamplesCount, learningRate, scratch);
+                    }
+
+                    const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+                    return steps / elapsed.count();
+                };
+
+
+                auto runLegacy = [&]() {
+
+                    float positiveError;
+
+                    const tensor<float> negativeErrors = scratch.allocate<float>({negativeSamplesCount});
+
+                    const auto start = std::chrono::high_resolution_clock::now();
+
+                    for (int s = 0; s < steps; s++) {
+
+                        int* stepIndices = indices.data() + static_cast<size_t>(s) * (negativeSamplesCount + 2);
+
+                        const tensor<int> negativeIndices(stepIndices + 2, {negativeSamplesCount});
+
+                        forwardPass(positiveError, negativeErrors, embeddings[stepIndices[0]], embeddings[stepIndices[1]], negativeIndices, embeddings, scratch);
+
+                        backpropagation(embeddings[stepIndices[0]], embeddings[stepIndices[1]], learningRate, negativeIndices, embeddings, positiveError, negativeErrors, scratch);
+                    }
+
+                    scratch.reset();
+
+                    const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+                    return steps / elapsed.count();
+                };
+
+
+                double legacy = 0.0;
+                double generic = 0.0;
+                double specialized = 0.0;
+
+                for (int r = 0; r < repeats; r++) {
+
+                    legacy = std::max(legacy, runLegacy());
+                    generic = std::max(generic, runKernel(trainStepGeneric<float>));
+                    specialized = std::max(specialized, runKernel(trainStepSpecialized<float>(dimension, negativeSamplesCount)));
+                }
+
+                std::cout << dimension << "," << negativeSamplesCount << ","
+                << legacy << "," << generic << "," << specialized << ","
+                << specialized / generic << "," << specialized / legacy << "\n";
+            }
+        }
+    }
+
+
+
+    template<typename T>
+    static float trainArticle(
+        const std::vector<int> &tokenizedWords,
+        const tensor<T> &embeddings,
+        const trainStepFunction<T> &trainStepKernel,
+        const int &dimension,
+        const int &windowSize,
+        const int &negativeSamplesCount,
+        const float &learningRate,
+        std::mt19937 &rng,
+        size_t &iterations,
+        arena &scratch,
+        std::vector<std::uint8_t>* touchedRows = nullptr) {
+
+        std::uniform_int_distribution dist(0, static_cast<int>(embeddings.shape[0] - 1));
+
+        T** negativeEmbeddings = scratch.allocateArray<T*>(negativeSamplesCount);
+
+        float loss = 0;
+
+        if (touchedRows != nullptr) {
+            for (const auto& i : tokenizedWords) {
+
+                (*touchedRows)[i] = 1;
+            }
+        }
+
+        for (int i = 0; i < tokenizedWords.size(); i++) {
+
+            for (int j = i - windowSize; j < i + windowSize + 1; j++) {
+
+                if (j == i || j < 0 || j >= tokenizedWords.size()) {
+                    continue;
+                }
+
+
+                for (int k = 0; k < negativeSamplesCount; k++) {
+
+                    const int negativeIndex = dist(rng);
+
+                    negativeEmbeddings[k] = embeddings.row(negativeIndex);
+
+                    if (touchedRows != nullptr) {
+                        (*touchedRows)[negativeIndex] = 1;
+                    }
+                }
+
+                loss += trainStepKernel(
+                    embeddings.row(tokenizedWords[i]),
+                    embeddings.row(tokenizedWords[j]),
+                    negativeEmbeddings,
+                    dimension,
+                    negativeSamplesCount,
+                    learningRate,
+                    scratch);
+
+                iterations++;
+            }
+        }
+
+        return loss;
+    }
+
+
+    static void generateSyntheticArticle(std::vector<int> &tokenizedWords, const int &length, const int &size, std::mt19937 &rng) {
+
+        std::uniform_int_distribution successorDist(1, 4);
+
+        tokenizedWords.resize(length);
+
+        tokenizedWords[0] = std::uniform_int_distribution(0, size - 1)(rng);
+
+        for (int i = 1; i < length; i++) {
+
+            tokenizedWords[i] = static_cast<int>((static_cast<long long>(tokenizedWords[i - 1]) * 31 + successorDist(rng)) % size);
+        }
+    }
+
+
+    template<typename T>
+    static std::vector<float> benchmarkPrecisionRun(const int &articles, double &pairsPerSecond) {
+
+        constexpr int size = 30000;
+
+        constexpr int dimension = 512;
+
+        constexpr int windowSize = 5;
+
         constexpr int negativeSamplesCount = 5;
 
+        constexpr float learningRate = 0.025f;
 
+        constexpr int articleLength = 1000;
 
 
+        std::mt19937 rng(42);
 
-        std::random_device dev;
-        std::mt19937 rng(dev());
+        std::uniform_real_distribution<float> dist(-0.1f, 0.1f);
 
+        parameterPool pool;
 
+        const tensor<T> embeddings = pool.allocateRows<T>(size, dimension);
 
+        std::uint32_t state = roundingState();
 
+        for (int i = 0; i < size; i++) {
 
+            const std::uint32_t seed = nextSeed(state);
 
-        auto *root = new trieNode;
+            for (int j = 0; j < dimension; j++) {
 
-        std::vector<std::string> vocabulary;
+                store(embeddings(i, j), dist(rng), roundingNoise(seed, j));
+            }
+        }
 
-        std::ifstream vocabularyFile("../output/vocabulary.txt");
+        roundingState() = state;
 
-        loadVocabulary(vocabularyFile, vocabulary);
 
-        buildTrie(root, vocabulary);
+        const trainStepFunction<T> trainStepKernel = trainStepGeneric<T>;
 
+        std::vector<int> tokenizedWords;
 
+        std::vector<float> losses;
 
+        arena scratch;
 
-        // std::ofstream embeddingsFileOut("../output/embeddings.bin", std::ios::binary);
-        //
-        // generateEmbeddings(embeddingsFileOut, dimension, static_cast<int>(vocabulary.size()), rng);
-        //
-        // embeddingsFileOut.close();
+        size_t totalIterations = 0;
 
+        std::chrono::duration<double> trainingTime{};
 
+        for (int v = 0; v < articles; v++) {
 
+            generateSyntheticArticle(tokenizedWords, articleLength, size, rng);
 
+            size_t iterations = 0;
 
-        std::ifstream embeddingsFileIn("../output/embeddings.bin", std::ios::binary);
+            const auto start = std::chrono::high_resolution_clock::now();
 
-        std::vector<std::vector<float>> embeddings;
+            const float loss = trainArticle(tokenizedWords, embeddings, trainStepKernel, dimension, windowSize, negativeSamplesCount, learningRate, rng, iterations, scratch);
 
-        loadEmbeddings(embeddingsFileIn, dimension, static_cast<int>(vocabulary.size()), embeddings);
+            trainingTime += std::chrono::high_resolution_clock::now() - start;
 
+            scratch.reset();
 
+            totalIterations += iterations;
 
+            losses.push_back(loss / iterations);
+        }
 
-        std::vector<std::string> words;
+        pairsPerSecond = totalIterations / trainingTime.count();
 
-        std::ifstream corpusFile("/home/swann7777777/Documents/simplewiki-20250701-pages-articles-multistream.xml");
+        return losses;
+    }
 
-        std::uniform_int_distribution dist(0, static_cast<int>(vocabulary.size() - 1));
 
-        std::ofstream lossesFile("../output/losses.csv");
+    static void benchmarkPrecision() {
 
+        constexpr int articles = 200;
 
+        double fp32PairsPerSecond;
 
-        for (int v = 0; v < 10000; v++) {
+        double bf16PairsPerSecond;
 
-            loadWords(words, corpusFile);
+        const std::vector<float> fp32Losses = benchmarkPrecisionRun<float>(articles, fp32PairsPerSecond);
 
-            std::vector<int> tokenizedWords;
+        const std::vector<float> bf16Losses = benchmarkPrecisionRun<bfloat16>(articles, bf16PairsPerSecond);
 
-            float positiveError;
+        std::ofstream lossesFile("../output/losses_precision.csv");
+
+        lossesFile << "article,fp32,bf16\n";
 
-            std::vector<float> negativeErrors(negativeSamplesCount);
+        for (int i = 0; i < articles; i++) {
 
-            std::vector<int> negativeSamplesIndices;
+            lossesFile << i << "," << fp32Losses[i] << "," << bf16Losses[i] << "\n";
+        }
 
-            tokenizeWords(words, root, tokenizedWords);
+        std::cout << "fp32 : " << fp32PairsPerSecond << " pairs/s, final loss " << fp32Losses.back() << "\n";
 
-            words.clear();
+        std::cout << "bf16 : " << bf16PairsPerSecond << " pairs/s, final loss " << bf16Losses.back() << "\n";
+
+        std::cout << "bf16 speedup : " << bf16PairsPerSecond / fp32PairsPerSecond << "\n";
+    }
+
+
+
+    static void benchmarkMemory() {
+
+        constexpr int size = 30000;
+
+        constexpr int dimension = 512;
+
+        constexpr int windowSize = 5;
+
+        constexpr int negativeSamplesCount = 5;
+
+        constexpr float learningRate = 0.025f;
+
+        constexpr int articles = 50;
 
-            float average_loss = 0;
+        constexpr int articleLength = 1000;
 
 
+        std::mt19937 rng(42);
+
+        std::uniform_real_distribution<float> dist(-0.1f, 0.1f);
+
+        std::uniform_int_distribution indexDist(0, size - 1);
+
+        parameterPool pool;
+
+        const tensor<float> embeddings = pool.allocateRows<float>(size, dimension);
+
+        for (int i = 0; i < size; i++) {
+            for (int j = 0; j < dimension; j++) {
+
+                embeddings(i, j) = dist(rng);
+            }
+        }
+
+        arena scratch;
+
+        std::vector<int> tokenizedWords;
+
+
+        auto run = [&](const std::string &name, const auto &step) {
+
+            scratch.peak = 0;
+
+            std::uint64_t allocations = 0;
+
             size_t iterations = 0;
 
+            std::chrono::duration<double> elapsed{};
 
-            for (int i = 0; i < tokenizedWords.size(); i++) {
+            for (int a = 0; a < articles; a++) {
 
-                for (int j = i - windowSize; j < i + windowSize + 1; j++) {
+                generateSyntheticArticle(tokenizedWords, articleLength, size, rng);
 
-                    if (j == i || j < 0 || j >= tokenizedWords.size()) {
-                        continue;
-                    }
+                const std::uint64_t allocationsBefore = allocationCounter::count();
 
+                const auto start = std::chrono::high_resolution_clock::now();
 
-                    std::vector<float> &centreEmbedding = embeddings[tokenizedWords[i]];
+                step(iterations);
 
-                    std::vector<float> &contextEmbedding = embeddings[tokenizedWords[j]];
+                elapsed += std::chrono::high_resolution_clock::now() - start;
 
-                    std::vector<int> negativeIndices(negativeSamplesCount);
+                allocations += allocationCounter::count() - allocationsBefore;
 
-                    for (int k = 0; k < negativeSamplesCount; k++) {
+                scratch.reset();
+            }
 
-                        negativeIndices[k] = dist(rng);
-                    }
+            std::cout << name << "," << static_cast<double>(allocations) / articles << "," << static_cast<double>(allocations) / iterations << ","
+            << scratch.peak << "," << iterations / elapsed.count() << "\n";
+        };
+
+
+        std::cout << "path,heap_allocations_per_article,heap_allocations_per_pair,peak_activation_bytes,pairs_per_s\n";
 
-                    forwardPass(
-                        positiveError,
-                        negativeErrors,
-                        centreEmbedding,
-                        contextEmbedding,
-                        negativeIndices,
-                        embeddings);
+        run("specialized", [&](size_t &iterations) {
 
+            trainArticle(tokenizedWords, embeddings, trainStepSpecialized<float>(dimension, negativeSamplesCount), dimension, windowSize, negativeSamplesCount, learningRate, rng, iterations, scratch);
+        });
 
-                    float loss = -std::log(positiveError);
+        run("generic", [&](size_t &iterations) {
 
-                    for (const auto& k : negativeErrors) {
+            trainArticle(tokenizedWords, embeddings, trainStepGeneric<float>, dimension, windowSize, negativeSamplesCount, learningRate, rng, iterations, scratch);
+        });
 
-                        loss += -std::log(k);
+        run("legacy", [&](size_t &iterations) {
+
+            float positiveError;
+
+            const tensor<int> negativeIndices = scratch.allocate<int>({negativeSamplesCount});
+
+            const tensor<float> negativeErrors = scratch.allocate<float>({negativeSamplesCount});
+
+            for (int i = 0; i < static_cast<int>(tokenizedWords.size()); i++) {
+
+                for (int j = std::max(0, i - windowSize); j < std::min(static_cast<int>(tokenizedWords.size()), i + windowSize + 1); j++) {
+
+                    if (j == i) {
+                        continue;
+                    }
+
+                    for (int k = 0; k < negativeSamplesCount; k++) {
+                        negativeIndices(k) = indexDist(rng);
                     }
 
-                    average_loss += loss;
+                    forwardPass(positiveError, negativeErrors, embeddings[tokenizedWords[i]], embeddings[tokenizedWords[j]], negativeIndices, embeddings, scratch);
+
+                    backpropagation(embeddings[tokenizedWords[i]], embeddings[tokenizedWords[j]], learningRate, negativeIndices, embeddings, positiveError, negativeErrors, scratch);
 
                     iterations++;
+                }
+            }
+        });
+
+        std::cout << "parameters : " << pool.bytes << " bytes, arena reserved : " << scratch.reserved << " bytes in " << scratch.blocks.size() << " block(s)\n";
+    }
 
-                    backpropagation(
-                        centreEmbedding,
-                        contextEmbedding,
-                        learningRate,
-                        negativeIndices,
-                        embeddings,
-                        positiveError,
-                        negativeErrors);
 
 
+    template<typename T>
+    static void outputEmbeddings(const tensor<T> &embeddings, std::ofstream &embeddingsFileOut) {
 
-                    negativeErrors.clear();
-                }
+        std::vector<float> row(embeddings.shape[1]);
+
+        for (int i = 0; i < embeddings.shape[0]; i++) {
+
+            for (int j = 0; j < embeddings.shape[1]; j++) {
+
+                row[j] = toFloat(embeddings(i, j));
             }
 
-            lossesFile << average_loss / iterations<< "\n";
+            embeddingsFileOut.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
         }
+    }
+
+
+
+    template<typename T = float>
+    static void embed() {
+
+        constexpr int dimension = 512;
+
+        constexpr int windowSize = 5;
+
+        constexpr float learningRate = 0.0005f;
+
+        constexpr int negativeSamplesCount = 5;
+
+
+
+
+
+        std::random_device dev;
+        std::mt19937 rng(dev());
+
+
+
+
+
+
+        vocabularyImage vocabulary;
+
+        vocabularyImage::load(vocabulary);
+
+
+
+
+        // std::ofstream embeddingsFileOut("../output/embeddings.bin", std::ios::binary);
+        //
+        // generateEmbeddings(embeddingsFileOut, dimension, vocabulary.size(), rng);
+        //
+        // embeddingsFileOut.close();
+
+
+
+
+
+        std::ifstream embeddingsFileIn("../output/embeddings.bin", std::ios::binary);
+
+        parameterPool pool;
+
+        tensor<T> embeddings;
+
+        loadEmbeddings(embeddingsFileIn, dimension, vocabulary.size(), pool, embeddings);
+
+
+
+
+        std::vector<std::string> words;
+
+        std::ifstream corpusFile("/home/swann7777777/Documents/simplewiki-20250701-pages-articles-multistream.xml");
+
+        std::ofstream lossesFile(std::is_same_v<T, bfloat16> ? "../output/losses_bf16.csv" : "../output/losses.csv");
+
+
+
+        const trainStepFunction<T> trainStepKernel = trainStepGeneric<T>;
+
+        arena scratch;
+
+        std::vector<int> tokenizedWords;
+
+        size_t totalIterations = 0;
+
+        std::uint64_t articleAllocations = 0;
+
+        std::chrono::duration<double> trainingTime{};
+
+
+
+        for (int v = 0; v < 10000; v++) {
+
+            loadWords(words, corpusFile);
+
+            tokenizedWords.clear();
+
+            vocabularyImage::tokenizeWords(words, vocabulary, tokenizedWords);
+
+            words.clear();
+
+            size_t iterations = 0;
+
+            const std::uint64_t allocationsBefore = allocationCounter::count();
+
+            const auto start = std::chrono::high_resolution_clock::now();
+
+            const float loss = trainArticle(
+                tokenizedWords,
+                embeddings,
+                trainStepKernel,
+                dimension,
+                windowSize,
+                negativeSamplesCount,
+                learningRate,
+                rng,
+                iterations,
+                scratch);
+
+            trainingTime += std::chrono::high_resolution_clock::now() - start;
+
+            articleAllocations += allocationCounter::count() - allocationsBefore;
+
+            scratch.reset();
+
+            totalIterations += iterations;
+
+            lossesFile << loss / iterations<< "\n";
+        }
+
+        std::cout << (std::is_same_v<T, bfloat16> ? "bf16" : "fp32") << " training : "
+        << totalIterations / trainingTime.count() << " pairs/s\n";
+
+        std::cout << "heap allocations per article : " << articleAllocations / 10000.0
+        << ", per training pair : " << static_cast<double>(articleAllocations) / totalIterations
+        << ", peak activation memory : " << scratch.peak << " bytes, parameters : " << pool.bytes << " bytes\n";
 
         std::ofstream embeddingsFileOut2("../output/embeddings.bin", std::ios::binary);
 
@@ -0,0 +1,547 @@
+#ifndef ENCODER_H
+#define ENCODER_H
+
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "embedding.h"
+#include "threadPool.h"
+#include "vocabularyImage.h"
+
+
+class encoder {
+public:
+
+    static constexpr size_t chunkBytes = 16 << 20;
+
+    static constexpr size_t maxCarryBytes = size_t{1} << 30;
+
+
+
+    enum class format {
+        text,
+        jsonl
+    };
+
+
+    struct part {
+
+        std::string word;
+
+        std::vector<int> tokens;
+
+        std::vector<std::uint8_t> bytes;
+
+        size_t tokenCount = 0;
+    };
+
+
+
+    static bool isLetter(const unsigned char c) {
+        return static_cast<unsigned char>((c | 32) - 'a') < 26;
+    }
+
+
+    static bool isBoundary(const unsigned char c, const format &f) {
+        return f == format::jsonl ? c == '\n' : !isLetter(c);
+    }
+
+
+    static void appendVarint(std::uint32_t value, std::vector<std::uint8_t> &bytes) {
+
+        while (value >= 0x80) {
+
+            bytes.push_back(static_cast<std::uint8_t>(value | 0x80));
+
+            value >>= 7;
+        }
+
+        bytes.push_back(static_cast<std::uint8_t>(value));
+    }
+
+
+    static bool readVarint(const std::uint8_t* &position, const std::uint8_t* end, std::uint32_t &value) {
+
+        value = 0;
+
+        for (int shift = 0; position < end && shift < 35; shift += 7) {
+
+            const std::uint8_t byte = *position++;
+
+            value |= static_cast<std::uint32_t>(byte & 0x7F) << shift;
+
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+
+
+    static void flushWord(part &p, const vocabularyImage &image) {
+
+        if (p.word.empty()) {
+            return;
+        }
+
+        p.tokens.clear();
+
+        vocabularyImage::tokenizeWord(p.word, image, p.tokens);
+
+        for (const auto& i : p.tokens) {
+            appendVarint(static_cast<std::uint32_t>(i), p.bytes);
+        }
+
+        p.tokenCount += p.tokens.size();
+
+        p.word.clear();
+    }
+
+
+    static void feed(const unsigned char c, part &p, const vocabularyImage &image) {
+
+        if (isLetter(c)) {
+            p.word += static_cast<char>(c | 32);
+        }
+
+        else {
+            flushWord(p, image);
+        }
+    }
+
+
+    static void encodeText(const std::string_view &text, part &p, const vocabularyImage &image) {
+
+        for (const char c : text) {
+            feed(c, p, image);
+        }
+
+        flushWord(p, image);
+    }
+
+
+    static int hexValue(const char c) {
+
+        if (c >= '0' && c <= '9') {
+            return c - '0';
+        }
+
+        return (c | 32) - 'a' + 10;
+    }
+
+
+    static size_t skipSpace(const std::string_view &line, size_t i) {
+
+        while (i < line.size() && (line[i] == ' ' || line[i] == '\t' || line[i] == '\r')) {
+            i++;
+        }
+
+        return i;
+    }
+
+
+    static size_t skipString(const std::string_view &line, size_t i) {
+
+        for (i++; i < line.size(); i++) {
+
+            if (line[i] == '\\') {
+                i++;
+            }
+
+            else if (line[i] == '"') {
+                return i + 1;
+            }
+        }
+
+        return std::string_view::npos;
+    }
+
+
+    static size_t skipValue(const std::string_view &line, size_t i) {
+
+        if (line[i] == '"') {
+            return skipString(line, i);
+        }
+
+        if (line[i] != '{' && line[i] != '[') {
+
+            while (i < line.size() && line[i] != ',' && line[i] != '}' && line[i] != ']') {
+                i++;
+            }
+
+            return i;
+        }
+
+        int depth = 0;
+
+        while (i < line.size()) {
+
+            if (line[i] == '"') {
+
+                i = skipString(line, i);
+
+                if (i == std::string_view::npos) {
+                    return i;
+                }
+
+                continue;
+            }
+
+            if (line[i] == '{' || line[i] == '[') {
+                depth++;
+            }
+
+            else if ((line[i] == '}' || line[i] == ']') && --depth == 0) {
+                return i + 1;
+            }
+
+            i++;
+        }
+
+        return std::string_view::npos;
+    }
+
+
+    template<typename Emit>
+    static void emitString(const std::string_view &line, size_t i, const Emit &emit) {
+
+        for (i++; i < line.size() && line[i] != '"'; i++) {
+
+            if (line[i] != '\\' || i + 1 >= line.size()) {
+
+                emit(line[i]);
+
+                continue;
+            }
+
+            const char escaped = line[++i];
+
+            if (escaped == 'u' && i + 4 < line.size()) {
+
+                const int code = hexValue(line[i + 1]) << 12 | hexValue(line[i + 2]) << 8 | hexValue(line[i + 3]) << 4 | hexValue(line[i + 4]);
+
+                emit(code < 0x80 ? static_cast<char>(code) : ' ');
+
+                i += 4;
+            }
+
+            else {
+                emit(escaped == 'n' || escaped == 't' || escaped == 'r' || escaped == 'b' || escaped == 'f' ? ' ' : escaped);
+            }
+        }
+    }
+
+
+    template<typename Emit>
+    static void scanJsonLines(const std::string_view &lines, const Emit &emit) {
+
+        size_t lineStart = 0;
+
+        while (lineStart < lines.size()) {
+
+            size_t lineEnd = lines.find('\n', lineStart);
+
+            if (lineEnd == std::string_view::npos) {
+                lineEnd = lines.size();
+            }
+
+            const std::string_view line = lines.substr(lineStart, lineEnd - lineStart);
+
+            lineStart = lineEnd + 1;
+
+            size_t i = skipSpace(line, 0);
+
+            if (i >= line.size() || line[i] != '{') {
+                continue;
+            }
+
+            for (i = skipSpace(line, i + 1); i < line.size() && line[i] == '"';) {
+
+                const size_t keyEnd = skipString(line, i);
+
+                if (keyEnd == std::string_view::npos) {
+                    break;
+                }
+
+                const std::string_view key = line.substr(i + 1, keyEnd - i - 2);
+
+                i = skipSpace(line, keyEnd);
+
+                if (i >= line.size() || line[i] != ':') {
+                    break;
+                }
+
+                i = skipSpace(line, i + 1);
+
+                if (i >= line.size()) {
+                    break;
+                }
+
+                if (key == "text" && line[i] == '"') {
+
+                    emitString(line, i, emit);
+
+                    emit(' ');
+
+                    break;
+                }
+
+                i = skipValue(line, i);
+
+                if (i == std::string_view::npos) {
+                    break;
+                }
+
+                i = skipSpace(line, i);
+
+                if (i >= line.size() || line[i] != ',') {
+                    break;
+                }
+
+                i = skipSpace(line, i + 1);
+            }
+        }
+    }
+
+
+
+    static size_t boundaryAfter(const std::string_view &data, size_t position, const format &f) {
+
+        while (position < data.size() && !isBoundary(data[position], f)) {
+            position++;
+        }
+
+        return position;
+    }
+
+
+    static void encodeChunk(const std::string_view &chunk, const format &f, const vocabularyImage &image, std::vector<part> &parts) {
+
+        const size_t count = parts.size();
+
+        std::vector<size_t> starts(count + 1, chunk.size());
+
+        starts[0] = 0;
+
+        for (size_t i = 1; i < count; i++) {
+            starts[i] = std::max(starts[i - 1], boundaryAfter(chunk, chunk.size() * i / count, f));
+        }
+
+        threadPool::parallelFor(static_cast<int>(count), [&](const int i, int) {
+
+            part &p = parts[i];
+
+            p.bytes.clear();
+
+            p.tokenCount = 0;
+
+            const std::string_view piece = chunk.substr(starts[i], starts[i + 1] - starts[i]);
+
+            if (f == format::jsonl) {
+                scanJsonLines(piece, [&](const char c) { feed(c, p, image); });
+            }
+
+            else {
+                encodeText(piece, p, image);
+            }
+        });
+    }
+
+
+
+    static void encodeFile(const std::string &inputPath, const std::string &outputPath, const format &f) {
+
+        vocabularyImage vocabulary;
+
+        vocabularyImage::load(vocabulary);
+
+        std::ifstream inputFile(inputPath, std::ios::binary);
+
+        if (!inputFile) {
+            throw std::runtime_error("encoder : cannot open " + inputPath);
+        }
+
+        std::ofstream outputFile(outputPath, std::ios::binary);
+
+        std::vector<part> parts(threadPool::instance().size() * 4);
+
+        std::string buffer;
+
+        std::string carry;
+
+        size_t inputBytes = 0;
+
+        size_t outputBytes = 0;
+
+        size_t tokens = 0;
+
+        const auto start = std::chrono::high_resolution_clock::now();
+
+        while (true) {
+
+            buffer.swap(carry);
+
+            const size_t kept = buffer.size();
+
+            buffer.resize(kept + chunkBytes);
+
+            inputFile.read(buffer.data() + kept, chunkBytes);
+
+            const size_t read = inputFile.gcount();
+
+            buffer.resize(kept + read);
+
+            inputBytes += read;
+
+            const bool last = read == 0;
+
+            size_t end = buffer.size();
+
+            if (!last) {
+
+                while (end > 0 && !isBoundary(buffer[end - 1], f)) {
+                    end--;
+                }
+
+                if (end == 0 && buffer.size() > maxCarryBytes) {
+                    throw std::runtime_error("encoder : " + inputPath + " has a " + (f == format::jsonl ? "line" : "word") + " longer than " + std::to_string(maxCarryBytes) + " bytes");
+                }
+            }
+
+            carry.assign(buffer, end);
+
+            buffer.resize(end);
+
+            if (!buffer.empty()) {
+
+                encodeChunk(buffer, f, vocabulary, parts);
+
+                for (const auto& i : parts) {
+
+                    outputFile.write(reinterpret_cast<const char*>(i.bytes.data()), static_cast<std::streamsize>(i.bytes.size()));
+
+                    outputBytes += i.bytes.size();
+
+                    tokens += i.tokenCount;
+                }
+            }
+
+            if (last) {
+                break;
+            }
+        }
+
+        outputFile.close();
+
+        const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+        std::cout << inputPath << " -> " << outputPath << " : " << inputBytes << " bytes in, " << tokens << " tokens, "
+        << outputBytes << " bytes out (" << static_cast<double>(outputBytes) / std::max<size_t>(tokens, 1) << " bytes/token)\n";
+
+        std::cout << inputBytes / elapsed.count() / (1024 * 1024) << " MB/s, " << tokens / elapsed.count() << " tokens/s, "
+        << threadPool::instance().size() << " threads\n";
+
+        vocabularyImage::unmap(vocabulary);
+    }
+
+
+    static format formatOf(const std::string &path, const std::string &name) {
+
+        if (name == "jsonl" || (name.empty() && path.ends_with(".jsonl"))) {
+            return format::jsonl;
+        }
+
+        return format::text;
+    }
+
+
+
+    static bool roundTrip(const std::string &inputPath, const std::string &encodedPath, const format &f) {
+
+        std::vector<std::string> vocabulary;
+
+        std::ifstream vocabularyFile("../output/vocabulary.txt");
+
+        embedding::loadVocabulary(vocabularyFile, vocabulary);
+
+        std::ifstream inputFile(inputPath, std::ios::binary);
+
+        std::string input((std::istreambuf_iterator<char>(inputFile)), std::istreambuf_iterator<char>());
+
+        std::string expected;
+
+        auto keepLetter = [&](const char c) {
+
+            if (isLetter(c)) {
+                expected += static_cast<char>(c | 32);
+            }
+        };
+
+        if (f == format::jsonl) {
+            scanJsonLines(input, keepLetter);
+        }
+
+        else {
+
+            for (const char c : input) {
+                keepLetter(c);
+            }
+        }
+
+        std::ifstream encodedFile(encodedPath, std::ios::binary);
+
+        const std::vector<std::uint8_t> encoded((std::istreambuf_iterator<char>(encodedFile)), std::istreambuf_iterator<char>());
+
+        std::string decoded;
+
+        decoded.reserve(expected.size());
+
+        const std::uint8_t* position = encoded.data();
+
+        std::uint32_t token;
+
+        size_t tokens = 0;
+
+        while (position < encoded.data() + encoded.size()) {
+
+            if (!readVarint(position, encoded.data() + encoded.size(), token) || token >= vocabulary.size()) {
+
+                std::cout << "round trip : invalid token id at token " << tokens << "\n";
+
+                return false;
+            }
+
+            decoded += vocabulary[token];
+
+            tokens++;
+        }
+
+        const auto mismatch = std::mismatch(decoded.begin(), decoded.end(), expected.begin(), expected.end());
+
+        if (mismatch.first != decoded.end() || mismatch.second != expected.end()) {
+
+            std::cout << "round trip : mismatch at letter " << mismatch.first - decoded.begin() << " of " << expected.size() << "\n";
+
+            return false;
+        }
+
+        std::cout << "round trip : " << tokens << " tokens decode through vocabulary.txt to the " << expected.size() << " letters of the input\n";
+
+        return true;
+    }
+};
+
+
+
+
+#endif //ENCODER_H
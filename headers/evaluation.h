@@ -0,0 +1,557 @@
+#ifndef EVALUATION_H
+#define EVALUATION_H
+
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "embedding.h"
+#include "gemm.h"
+#include "tensor.h"
+#include "threadPool.h"
+#include "vocabularyImage.h"
+
+
+class evaluation {
+public:
+
+    static constexpr int batchQuestions = 64;
+
+    static constexpr float mulEpsilon = 1e-3f;
+
+
+    struct model {
+
+        vocabularyImage vocabulary;
+
+        parameterPool pool;
+
+        tensor<float> unit;
+
+        int dimension = 0;
+    };
+
+
+    struct question {
+
+        std::vector<int> excluded;
+
+        int d;
+
+        int section;
+    };
+
+
+    struct analogySet {
+
+        std::vector<std::string> sections;
+
+        std::vector<question> questions;
+
+        std::vector<float> queries;
+
+        std::vector<int> totals;
+    };
+
+
+    struct result {
+
+        std::string task;
+
+        std::string section;
+
+        std::string method;
+
+        int items;
+
+        int covered;
+
+        double score;
+    };
+
+
+
+    static void normalize(float* vector, const int &dimension) {
+
+        double norm = 0.0;
+
+        for (int i = 0; i < dimension; i++) {
+            norm += static_cast<double>(vector[i]) * vector[i];
+        }
+
+        const float scale = norm > 0.0 ? static_cast<float>(1.0 / std::sqrt(norm)) : 0.0f;
+
+        for (int i = 0; i < dimension; i++) {
+            vector[i] *= scale;
+        }
+    }
+
+
+    static void loadModel(model &m, const std::string &embeddingsPath) {
+
+        vocabularyImage::load(m.vocabulary);
+
+        std::error_code error;
+
+        const auto bytes = std::filesystem::file_size(embeddingsPath, error);
+
+        const auto rowBytes = static_cast<std::uintmax_t>(m.vocabulary.size()) * sizeof(float);
+
+        if (error || bytes == 0 || bytes % rowBytes != 0) {
+            throw std::runtime_error("evaluation : " + embeddingsPath + " does not hold one row per vocabulary entry");
+        }
+
+        m.dimension = static_cast<int>(bytes / rowBytes);
+
+        std::ifstream embeddingsFileIn(embeddingsPath, std::ios::binary);
+
+        embedding::loadEmbeddings(embeddingsFileIn, m.dimension, m.vocabulary.size(), m.pool, m.unit);
+
+        threadPool::parallelFor(m.vocabulary.size(), [&](const int i, int) {
+            normalize(m.unit.row(i), m.dimension);
+        });
+    }
+
+
+    static bool wordVector(const model &m, const std::string &word, float* vector) {
+
+        std::vector<int> tokens;
+
+        vocabularyImage::tokenizeWord(word, m.vocabulary, tokens);
+
+        std::fill(vector, vector + m.dimension, 0.0f);
+
+        if (tokens.empty()) {
+            return false;
+        }
+
+        for (const auto& token : tokens) {
+
+            const float* row = m.unit.row(token);
+
+            for (int i = 0; i < m.dimension; i++) {
+                vector[i] += row[i];
+            }
+        }
+
+        normalize(vector, m.dimension);
+
+        return true;
+    }
+
+
+    static bool isWord(const std::string &word) {
+        return !word.empty() && std::all_of(word.begin(), word.end(), [](const char c) { return c >= 'a' && c <= 'z'; });
+    }
+
+
+
+    static std::vector<double> ranks(const std::vector<double> &values) {
+
+        std::vector<int> order(values.size());
+
+        std::iota(order.begin(), order.end(), 0);
+
+        std::sort(order.begin(), order.end(), [&](const int x, const int y) { return values[x] < values[y]; });
+
+        std::vector<double> rank(values.size());
+
+        for (size_t i = 0; i < order.size();) {
+
+            size_t j = i;
+
+            while (j + 1 < order.size() && values[order[j + 1]] == values[order[i]]) {
+                j++;
+            }
+
+            for (size_t k = i; k <= j; k++) {
+                rank[order[k]] = (static_cast<double>(i) + static_cast<double>(j)) / 2.0;
+            }
+
+            i = j + 1;
+        }
+
+        return rank;
+    }
+
+
+    static double pearson(const std::vector<double> &x, const std::vector<double> &y) {
+
+        const double n = static_cast<double>(x.size());
+
+        const double meanX = std::accumulate(x.begin(), x.end(), 0.0) / n;
+
+        const double meanY = std::accumulate(y.begin(), y.end(), 0.0) / n;
+
+        double covariance = 0.0;
+
+        double varianceX = 0.0;
+
+        double varianceY = 0.0;
+
+        for (size_t i = 0; i < x.size(); i++) {
+
+            covariance += (x[i] - meanX) * (y[i] - meanY);
+
+            varianceX += (x[i] - meanX) * (x[i] - meanX);
+
+            varianceY += (y[i] - meanY) * (y[i] - meanY);
+        }
+
+        return varianceX > 0.0 && varianceY > 0.0 ? covariance / std::sqrt(varianceX * varianceY) : 0.0;
+    }
+
+
+    static double spearman(const std::vector<double> &x, const std::vector<double> &y) {
+        return pearson(ranks(x), ranks(y));
+    }
+
+
+
+    static result similarity(const model &m, const std::string &path) {
+
+        std::ifstream file(path);
+
+        if (!file) {
+            throw std::runtime_error("evaluation : cannot open " + path);
+        }
+
+        std::vector<float> first(m.dimension);
+
+        std::vector<float> second(m.dimension);
+
+        std::vector<double> human;
+
+        std::vector<double> cosine;
+
+        int items = 0;
+
+        std::string line;
+
+        while (std::getline(file, line)) {
+
+            std::istringstream fields(line);
+
+            std::string x;
+
+            std::string y;
+
+            double score;
+
+            if (line.empty() || line[0] == '#' || !(fields >> x >> y >> score)) {
+                continue;
+            }
+
+            items++;
+
+            if (!isWord(x) || !isWord(y) || !wordVector(m, x, first.data()) || !wordVector(m, y, second.data())) {
+                continue;
+            }
+
+            human.push_back(score);
+
+            cosine.push_back(std::inner_product(first.begin(), first.end(), second.begin(), 0.0));
+        }
+
+        return {"similarity", std::filesystem::path(path).stem().string(), "spearman", items, static_cast<int>(human.size()),
+            human.size() > 1 ? spearman(human, cosine) : 0.0};
+    }
+
+
+
+    static void loadAnalogies(const model &m, const std::string &path, analogySet &set) {
+
+        std::ifstream file(path);
+
+        if (!file) {
+            throw std::runtime_error("evaluation : cannot open " + path);
+        }
+
+        std::string line;
+
+        while (std::getline(file, line)) {
+
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+
+            std::istringstream fields(line);
+
+            if (line[0] == ':') {
+
+                std::string name;
+
+                fields.ignore(1);
+
+                fields >> name;
+
+                set.sections.push_back(name);
+
+                set.totals.push_back(0);
+
+                continue;
+            }
+
+            if (set.sections.empty()) {
+
+                set.sections.push_back("default");
+
+                set.totals.push_back(0);
+            }
+
+            std::string words[4];
+
+            if (!(fields >> words[0] >> words[1] >> words[2] >> words[3])) {
+                continue;
+            }
+
+            const int section = static_cast<int>(set.sections.size()) - 1;
+
+            set.totals[section]++;
+
+            const int d = isWord(words[3]) ? m.vocabulary.find(words[3]) : -1;
+
+            if (d < 0 || !std::all_of(words, words + 3, isWord)) {
+                continue;
+            }
+
+            const size_t offset = set.queries.size();
+
+            set.queries.resize(offset + 3 * static_cast<size_t>(m.dimension));
+
+            question item{{}, d, section};
+
+            bool pooled = true;
+
+            for (int i = 0; i < 3 && pooled; i++) {
+
+                pooled = wordVector(m, words[i], set.queries.data() + offset + static_cast<size_t>(i) * m.dimension);
+
+                vocabularyImage::tokenizeWord(words[i], m.vocabulary, item.excluded);
+            }
+
+            if (!pooled) {
+
+                set.queries.resize(offset);
+
+                continue;
+            }
+
+            set.questions.push_back(std::move(item));
+        }
+    }
+
+
+    static void answer(const model &m, const analogySet &set, std::vector<int> &byAdd, std::vector<int> &byMul) {
+
+        const std::vector<question> &questions = set.questions;
+
+        const int size = m.vocabulary.size();
+
+        const int dimension = m.dimension;
+
+        byAdd.assign(questions.size(), -1);
+
+        byMul.assign(questions.size(), -1);
+
+        arena scratch(static_cast<std::size_t>(batchQuestions) * 3 * (size + dimension) * sizeof(float));
+
+        for (size_t start = 0; start < questions.size(); start += batchQuestions) {
+
+            const int count = static_cast<int>(std::min<size_t>(batchQuestions, questions.size() - start));
+
+            const arena::marker before = scratch.mark();
+
+            const tensor<float> queries = scratch.allocate<float>({count * 3, dimension});
+
+            const tensor<float> scores = scratch.allocate<float>({count * 3, size});
+
+            for (int q = 0; q < count * 3; q++) {
+                std::copy_n(set.queries.data() + (start * 3 + q) * dimension, dimension, queries.row(q));
+            }
+
+            gemm::multiply(false, true, count * 3, size, dimension, queries.data, dimension, m.unit.data, static_cast<int>(m.unit.strides[0]), scores.data, size);
+
+            threadPool::parallelFor(count, [&](const int q, int) {
+
+                const question &item = questions[start + q];
+
+                const float* toA = scores.row(q * 3);
+
+                const float* toB = scores.row(q * 3 + 1);
+
+                const float* toC = scores.row(q * 3 + 2);
+
+                float bestAdd = -std::numeric_limits<float>::infinity();
+
+                float bestMul = -std::numeric_limits<float>::infinity();
+
+                int add = -1;
+
+                int mul = -1;
+
+                for (int j = 0; j < size; j++) {
+
+                    if (std::find(item.excluded.begin(), item.excluded.end(), j) != item.excluded.end()) {
+                        continue;
+                    }
+
+                    const float cosAdd = toB[j] - toA[j] + toC[j];
+
+                    const float cosMul = (toB[j] + 1.0f) * (toC[j] + 1.0f) / (toA[j] + 1.0f + 2.0f * mulEpsilon) * 0.5f;
+
+                    if (cosAdd > bestAdd) {
+
+                        bestAdd = cosAdd;
+
+                        add = j;
+                    }
+
+                    if (cosMul > bestMul) {
+
+                        bestMul = cosMul;
+
+                        mul = j;
+                    }
+                }
+
+                byAdd[start + q] = add;
+
+                byMul[start + q] = mul;
+            });
+
+            scratch.rewind(before);
+        }
+    }
+
+
+    static void analogies(const model &m, const std::string &path, std::vector<result> &results) {
+
+        analogySet set;
+
+        loadAnalogies(m, path, set);
+
+        std::vector<int> byAdd;
+
+        std::vector<int> byMul;
+
+        answer(m, set, byAdd, byMul);
+
+        const int sections = static_cast<int>(set.sections.size());
+
+        std::vector<int> covered(sections + 1, 0);
+
+        std::vector<int> correctAdd(sections + 1, 0);
+
+        std::vector<int> correctMul(sections + 1, 0);
+
+        for (size_t i = 0; i < set.questions.size(); i++) {
+
+            for (const int s : {set.questions[i].section, sections}) {
+
+                covered[s]++;
+
+                correctAdd[s] += byAdd[i] == set.questions[i].d;
+
+                correctMul[s] += byMul[i] == set.questions[i].d;
+            }
+        }
+
+        const int total = std::accumulate(set.totals.begin(), set.totals.end(), 0);
+
+        std::cerr << std::filesystem::path(path).filename().string() << " : " << total - covered[sections] << " of " << total
+        << " questions skipped (answer not a single vocabulary entry)\n";
+
+        for (int s = 0; s <= sections; s++) {
+
+            const std::string name = s < sections ? set.sections[s] : "all";
+
+            const int items = s < sections ? set.totals[s] : total;
+
+            const double scale = covered[s] > 0 ? 1.0 / covered[s] : 0.0;
+
+            results.push_back({"analogy", name, "3cosadd", items, covered[s], correctAdd[s] * scale});
+
+            results.push_back({"analogy", name, "3cosmul", items, covered[s], correctMul[s] * scale});
+        }
+    }
+
+
+
+    static void writeResults(std::ostream &out, const std::vector<result> &results) {
+
+        out << "task,section,method,items,covered,score\n";
+
+        for (const auto& i : results) {
+            out << i.task << "," << i.section << "," << i.method << "," << i.items << "," << i.covered << "," << i.score << "\n";
+        }
+    }
+
+
+    static void run(const std::string &embeddingsPath, const std::string &dataDirectory = "../evaluation") {
+
+        model m;
+
+        const auto loadStart = std::chrono::high_resolution_clock::now();
+
+        loadModel(m, embeddingsPath);
+
+        const auto start = std::chrono::high_resolution_clock::now();
+
+        std::vector<result> results;
+
+        std::vector<std::filesystem::path> files;
+
+        for (const auto& i : std::filesystem::directory_iterator(dataDirectory)) {
+
+            if (i.path().extension() == ".txt") {
+                files.push_back(i.path());
+            }
+        }
+
+        std::sort(files.begin(), files.end());
+
+        for (const auto& i : files) {
+
+            if (i.stem().string().starts_with("analogies")) {
+                analogies(m, i.string(), results);
+            }
+
+            else {
+                results.push_back(similarity(m, i.string()));
+            }
+        }
+
+        const auto end = std::chrono::high_resolution_clock::now();
+
+        writeResults(std::cout, results);
+
+        std::ofstream resultsFile("../output/evaluation.csv");
+
+        writeResults(resultsFile, results);
+
+        const std::chrono::duration<double> loadSeconds = start - loadStart;
+
+        const std::chrono::duration<double> evaluationSeconds = end - start;
+
+        std::cerr << "evaluation : " << m.vocabulary.size() << " x " << m.dimension << " embeddings loaded in " << loadSeconds.count()
+        << " s, evaluated in " << evaluationSeconds.count() << " s on " << threadPool::instance().size() << " threads\n";
+
+        vocabularyImage::unmap(m.vocabulary);
+    }
+};
+
+
+
+
+#endif //EVALUATION_H
@@ -0,0 +1,405 @@
+#ifndef FEEDFORWARD_H
+#define FEEDFORWARD_H
+
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "gemm.h"
+
+
+class feedForward {
+public:
+
+    struct weights {
+
+        int dModel = 0;
+
+        int dHidden = 0;
+
+        gemm::activation act = gemm::activation::gelu;
+
+        std::vector<float> w1;
+
+        std::vector<float> b1;
+
+        std::vector<float> w2;
+
+        std::vector<float> b2;
+    };
+
+
+    struct activations {
+
+        std::vector<float> preActivation;
+
+        std::vector<float> hidden;
+    };
+
+
+    struct gradients {
+
+        std::vector<float> w1;
+
+        std::vector<float> b1;
+
+        std::vector<float> w2;
+
+        std::vector<float> b2;
+    };
+
+
+
+    static void initializeWeights(weights &w, const int &dModel, const int &dHidden, const gemm::activation &act, std::mt19937 &rng) {
+
+        w.dModel = dModel;
+
+        w.dHidden = dHidden;
+
+        w.act = act;
+
+        std::uniform_real_distribution<float> dist1(-std::sqrt(6.0f / (dModel + dHidden)), std::sqrt(6.0f / (dModel + dHidden)));
+
+        w.w1.resize(static_cast<size_t>(dModel) * dHidden);
+
+        w.w2.resize(static_cast<size_t>(dHidden) * dModel);
+
+        for (auto& i : w.w1) {
+            i = dist1(rng);
+        }
+
+        for (auto& i : w.w2) {
+            i = dist1(rng);
+        }
+
+        w.b1.assign(dHidden, 0.01f);
+
+        w.b2.assign(dModel, 0.0f);
+    }
+
+
+
+    static void forward(const weights &w, const float* x, const int &rows, activations &a, float* y, const bool &training) {
+
+        a.hidden.resize(static_cast<size_t>(rows) * w.dHidden);
+
+        gemm::epilogue first;
+
+        first.bias = w.b1.data();
+
+        first.act = w.act;
+
+        if (training) {
+
+            a.preActivation.resize(a.hidden.size());
+
+            first.preActivation = a.preActivation.data();
+
+            first.ldPreActivation = w.dHidden;
+        }
+
+        gemm::multiply(false, false, rows, w.dHidden, w.dModel, x, w.dModel, w.w1.data(), w.dHidden, a.hidden.data(), w.dHidden, first);
+
+        gemm::epilogue second;
+
+        second.bias = w.b2.data();
+
+        gemm::multiply(false, false, rows, w.dModel, w.dHidden, a.hidden.data(), w.dHidden, w.w2.data(), w.dModel, y, w.dModel, second);
+    }
+
+
+    static void columnSums(const float* matrix, const int &rows, const int &columns, std::vector<float> &sums) {
+
+        sums.assign(columns, 0.0f);
+
+        for (int i = 0; i < rows; i++) {
+
+            const float* row = matrix + static_cast<size_t>(i) * columns;
+
+            for (int j = 0; j < columns; j++) {
+                sums[j] += row[j];
+            }
+        }
+    }
+
+
+    static void backward(const weights &w, const float* x, const int &rows, const activations &a, const float* dy, gradients &g, float* dx) {
+
+        std::vector<float> dPreActivation(static_cast<size_t>(rows) * w.dHidden);
+
+        g.w1.resize(w.w1.size());
+
+        g.w2.resize(w.w2.size());
+
+        columnSums(dy, rows, w.dModel, g.b2);
+
+        gemm::multiply(true, false, w.dHidden, w.dModel, rows, a.hidden.data(), w.dHidden, dy, w.dModel, g.w2.data(), w.dModel);
+
+        gemm::epilogue chain;
+
+        chain.derivativeOf = a.preActivation.data();
+
+        chain.ldDerivativeOf = w.dHidden;
+
+        chain.derivativeActivation = w.act;
+
+        gemm::multiply(false, true, rows, w.dHidden, w.dModel, dy, w.dModel, w.w2.data(), w.dModel, dPreActivation.data(), w.dHidden, chain);
+
+        columnSums(dPreActivation.data(), rows, w.dHidden, g.b1);
+
+        gemm::multiply(true, false, w.dModel, w.dHidden, rows, x, w.dModel, dPreActivation.data(), w.dHidden, g.w1.data(), w.dHidden);
+
+        gemm::multiply(false, true, rows, w.dModel, w.dHidden, dPreActivation.data(), w.dHidden, w.w1.data(), w.dHidden, dx, w.dModel);
+    }
+
+
+
+    static void forwardReference(const weights &w, const float* x, const int &rows, activations &a, float* y) {
+
+        a.hidden.resize(static_cast<size_t>(rows) * w.dHidden);
+
+        a.preActivation.resize(a.hidden.size());
+
+        gemm::epilogue first;
+
+        first.bias = w.b1.data();
+
+        first.act = w.act;
+
+        first.preActivation = a.preActivation.data();
+
+        first.ldPreActivation = w.dHidden;
+
+        gemm::multiplyReference(false, false, rows, w.dHidden, w.dModel, x, w.dModel, w.w1.data(), w.dHidden, a.hidden.data(), w.dHidden, first);
+
+        gemm::epilogue second;
+
+        second.bias = w.b2.data();
+
+        gemm::multiplyReference(false, false, rows, w.dModel, w.dHidden, a.hidden.data(), w.dHidden, w.w2.data(), w.dModel, y, w.dModel, second);
+    }
+
+
+    static void backwardReference(const weights &w, const float* x, const int &rows, const activations &a, const float* dy, gradients &g, float* dx) {
+
+        std::vector<float> dPreActivation(static_cast<size_t>(rows) * w.dHidden);
+
+        g.w1.resize(w.w1.size());
+
+        g.w2.resize(w.w2.size());
+
+        columnSums(dy, rows, w.dModel, g.b2);
+
+        gemm::multiplyReference(true, false, w.dHidden, w.dModel, rows, a.hidden.data(), w.dHidden, dy, w.dModel, g.w2.data(), w.dModel);
+
+        gemm::epilogue chain;
+
+        chain.derivativeOf = a.preActivation.data();
+
+        chain.ldDerivativeOf = w.dHidden;
+
+        chain.derivativeActivation = w.act;
+
+        gemm::multiplyReference(false, true, rows, w.dHidden, w.dModel, dy, w.dModel, w.w2.data(), w.dModel, dPreActivation.data(), w.dHidden, chain);
+
+        columnSums(dPreActivation.data(), rows, w.dHidden, g.b1);
+
+        gemm::multiplyReference(true, false, w.dModel, w.dHidden, rows, x, w.dModel, dPreActivation.data(), w.dHidden, g.w1.data(), w.dHidden);
+
+        gemm::multiplyReference(false, true, rows, w.dModel, w.dHidden, dPreActivation.data(), w.dHidden, w.w1.data(), w.dHidden, dx, w.dModel);
+    }
+
+
+
+    static float relativeError(const std::vector<float> &value, const std::vector<float> &reference) {
+
+        double difference = 0;
+
+        double norm = 0;
+
+        for (size_t i = 0; i < value.size(); i++) {
+
+            difference += static_cast<double>(value[i] - reference[i]) * (value[i] - reference[i]);
+
+            norm += static_cast<double>(reference[i]) * reference[i];
+        }
+
+        return static_cast<float>(std::sqrt(difference / std::max(norm, 1e-30)));
+    }
+
+
+    static void benchmark() {
+
+        std::mt19937 rng(42);
+
+        std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+        auto seconds = [](const auto &run, const int &repeats) {
+
+            run();
+
+            const auto start = std::chrono::high_resolution_clock::now();
+
+            for (int i = 0; i < repeats; i++) {
+                run();
+            }
+
+            const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+            return elapsed.count() / repeats;
+        };
+
+
+        std::cout << "sgemm m,n,k,gflops,naive_gflops\n";
+
+        for (const int size : {256, 512, 1024, 2048}) {
+
+            std::vector<float> a(static_cast<size_t>(size) * size), b(a.size()), c(a.size());
+
+            for (auto& i : a) {
+                i = dist(rng);
+            }
+
+            for (auto& i : b) {
+                i = dist(rng);
+            }
+
+            const double flops = 2.0 * size * size * size;
+
+            const double blocked = seconds([&] { gemm::multiply(false, false, size, size, size, a.data(), size, b.data(), size, c.data(), size); }, 3);
+
+            const double naive = size <= 512 ? seconds([&] { gemm::multiplyReference(false, false, size, size, size, a.data(), size, b.data(), size, c.data(), size); }, 1) : 0;
+
+            std::cout << size << "," << size << "," << size << "," << flops / blocked * 1e-9 << "," << (naive > 0 ? flops / naive * 1e-9 : 0) << "\n";
+        }
+
+
+        std::cout << "sgemm small m,n,k,trans_a,epilogue,error\n";
+
+        for (int m = 1; m <= gemm::MR; m++) {
+            for (const bool transA : {false, true}) {
+                for (const int variant : {0, 1, 2}) {
+
+                    constexpr int n = 1000;
+
+                    constexpr int k = 512;
+
+                    std::vector<float> a(static_cast<size_t>(m) * k), b(static_cast<size_t>(k) * n), bias(n);
+
+                    for (auto& i : a) {
+                        i = dist(rng);
+                    }
+
+                    for (auto& i : b) {
+                        i = dist(rng);
+                    }
+
+                    for (auto& i : bias) {
+                        i = dist(rng);
+                    }
+
+                    std::vector<float> c(static_cast<size_t>(m) * n), cReference(c.size()), pre(c.size()), preReference(c.size());
+
+                    for (size_t i = 0; i < c.size(); i++) {
+                        c[i] = cReference[i] = dist(rng);
+                    }
+
+                    gemm::epilogue e, eReference;
+
+                    if (variant == 1) {
+
+                        e.bias = eReference.bias = bias.data();
+
+                        e.act = eReference.act = gemm::activation::gelu;
+
+                        e.preActivation = pre.data();
+
+                        eReference.preActivation = preReference.data();
+
+                        e.ldPreActivation = eReference.ldPreActivation = n;
+                    }
+
+                    else if (variant == 2) {
+                        e.accumulate = eReference.accumulate = true;
+                    }
+
+                    const int lda = transA ? m : k;
+
+                    gemm::multiply(transA, false, m, n, k, a.data(), lda, b.data(), n, c.data(), n, e);
+
+                    gemm::multiplyReference(transA, false, m, n, k, a.data(), lda, b.data(), n, cReference.data(), n, eReference);
+
+                    std::cout << m << "," << n << "," << k << "," << transA << "," << (variant == 0 ? "none" : variant == 1 ? "bias_gelu" : "accumulate") << ","
+                    << std::max(relativeError(c, cReference), variant == 1 ? relativeError(pre, preReference) : 0.0f) << "\n";
+                }
+            }
+        }
+
+
+        constexpr int dModel = 512;
+
+        constexpr int dHidden = 2048;
+
+        std::cout << "ffn rows,activation,forward_gflops,backward_gflops,forward_error,dx_error,dw1_error,dw2_error,db1_error\n";
+
+        for (const auto act : {gemm::activation::relu, gemm::activation::gelu}) {
+
+            weights w;
+
+            initializeWeights(w, dModel, dHidden, act, rng);
+
+            for (const int rows : {1, 6, 64, 512, 2048}) {
+
+                std::vector<float> x(static_cast<size_t>(rows) * dModel), dy(x.size()), y(x.size()), dx(x.size());
+
+                for (auto& i : x) {
+                    i = dist(rng);
+                }
+
+                for (auto& i : dy) {
+                    i = dist(rng);
+                }
+
+                activations a;
+
+                gradients g;
+
+                const double forwardFlops = 4.0 * rows * dModel * dHidden;
+
+                const double forwardSeconds = seconds([&] { forward(w, x.data(), rows, a, y.data(), true); }, 5);
+
+                const double backwardSeconds = seconds([&] { backward(w, x.data(), rows, a, dy.data(), g, dx.data()); }, 5);
+
+                std::cout << rows << "," << (act == gemm::activation::relu ? "relu" : "gelu") << ","
+                << forwardFlops / forwardSeconds * 1e-9 << "," << 2 * forwardFlops / backwardSeconds * 1e-9;
+
+                if (rows <= 64) {
+
+                    std::vector<float> yReference(x.size()), dxReference(x.size());
+
+                    activations aReference;
+
+                    gradients gReference;
+
+                    forwardReference(w, x.data(), rows, aReference, yReference.data());
+
+                    backwardReference(w, x.data(), rows, aReference, dy.data(), gReference, dxReference.data());
+
+                    std::cout << "," << relativeError(y, yReference) << "," << relativeError(dx, dxReference) << ","
+                    << relativeError(g.w1, gReference.w1) << "," << relativeError(g.w2, gReference.w2) << ","
+                    << relativeError(g.b1, gReference.b1);
+                }
+
+                std::cout << "\n";
+            }
+        }
+    }
+};
+
+
+
+
+#endif //FEEDFORWARD_H
@@ -0,0 +1,526 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "threadPool.h"
+
+
+class gemm {
+public:
+
+    static constexpr int MR = 6;
+
+    static constexpr int NR = 16;
+
+    static constexpr int MC = 96;
+
+    static constexpr int KC = 512;
+
+    static constexpr int NC = 4096;
+
+    static constexpr int NG = 256;
+
+
+
+    enum class activation {
+        none,
+        relu,
+        gelu
+    };
+
+
+    struct epilogue {
+
+        const float* bias = nullptr;
+
+        activation act = activation::none;
+
+        float* preActivation = nullptr;
+
+        int ldPreActivation = 0;
+
+        const float* derivativeOf = nullptr;
+
+        int ldDerivativeOf = 0;
+
+        activation derivativeActivation = activation::none;
+
+        bool accumulate = false;
+    };
+
+
+
+    static float fastExp(float x) {
+
+        x = std::clamp(x, -87.0f, 88.0f);
+
+        const float n = std::nearbyint(x * 1.44269504f);
+
+        const float r = x - n * 0.693145751953125f - n * 1.428606765330187e-06f;
+
+        float p = 1.0f / 720.0f;
+
+        p = p * r + 1.0f / 120.0f;
+        p = p * r + 1.0f / 24.0f;
+        p = p * r + 1.0f / 6.0f;
+        p = p * r + 0.5f;
+        p = p * r + 1.0f;
+        p = p * r + 1.0f;
+
+        return p * std::bit_cast<float>(static_cast<std::int32_t>(n + 127.0f) << 23);
+    }
+
+
+    static float fastTanh(const float x) {
+
+        const float e = fastExp(2.0f * std::clamp(x, -9.0f, 9.0f));
+
+        return (e - 1.0f) / (e + 1.0f);
+    }
+
+
+    static float gelu(const float x) {
+        return 0.5f * x * (1.0f + fastTanh(0.7978845608f * (x + 0.044715f * x * x * x)));
+    }
+
+
+    static float geluDerivative(const float x) {
+
+        const float inner = 0.7978845608f * (x + 0.044715f * x * x * x);
+
+        const float t = fastTanh(inner);
+
+        return 0.5f * (1.0f + t) + 0.5f * x * (1.0f - t * t) * 0.7978845608f * (1.0f + 3.0f * 0.044715f * x * x);
+    }
+
+
+    static float activate(const float x, const activation &act) {
+
+        switch (act) {
+            case activation::relu: return x > 0 ? x : 0.0f;
+            case activation::gelu: return gelu(x);
+            default: return x;
+        }
+    }
+
+
+    static float derivative(const float x, const activation &act) {
+
+        switch (act) {
+            case activation::relu: return x > 0 ? 1.0f : 0.0f;
+            case activation::gelu: return geluDerivative(x);
+            default: return 1.0f;
+        }
+    }
+
+
+
+    static float element(const float* matrix, const int &ld, const bool &transposed, const int &row, const int &column) {
+        return transposed ? matrix[static_cast<size_t>(column) * ld + row] : matrix[static_cast<size_t>(row) * ld + column];
+    }
+
+
+    static void packA(const float* a, const int &lda, const bool &transA, const int &rowStart, const int &rows, const int &depthStart, const int &depth, float* packed) {
+
+        for (int s = 0; s < rows; s += MR) {
+
+            for (int k = 0; k < depth; k++) {
+                for (int r = 0; r < MR; r++) {
+
+                    *packed++ = s + r < rows ? element(a, lda, transA, rowStart + s + r, depthStart + k) : 0.0f;
+                }
+            }
+        }
+    }
+
+
+    static void packB(const float* b, const int &ldb, const bool &transB, const int &depthStart, const int &depth, const int &columnStart, const int &columns, float* packed) {
+
+        if (!transB && columns == NR) {
+
+            for (int k = 0; k < depth; k++) {
+
+                std::copy_n(b + static_cast<size_t>(depthStart + k) * ldb + columnStart, NR, packed + k * NR);
+            }
+
+            return;
+        }
+
+        for (int k = 0; k < depth; k++) {
+            for (int c = 0; c < NR; c++) {
+
+                packed[k * NR + c] = c < columns ? element(b, ldb, transB, depthStart + k, columnStart + c) : 0.0f;
+            }
+        }
+    }
+
+
+
+    static void storeTile(
+        const float (&tile)[MR][NR],
+        float* c,
+        const int &ldc,
+        const int &row,
+        const int &column,
+        const int &rows,
+        const int &columns,
+        const bool &first,
+        const bool &last,
+        const epilogue &e) {
+
+        for (int i = 0; i < rows; i++) {
+
+            float* cRow = c + static_cast<size_t>(row + i) * ldc + column;
+
+            float values[NR];
+
+            for (int j = 0; j < NR; j++) {
+                values[j] = tile[i][j];
+            }
+
+            if (!first || e.accumulate) {
+
+                for (int j = 0; j < columns; j++) {
+                    values[j] += cRow[j];
+                }
+            }
+
+            if (last) {
+
+                if (e.bias != nullptr) {
+
+                    for (int j = 0; j < columns; j++) {
+                        values[j] += e.bias[column + j];
+                    }
+                }
+
+                if (e.preActivation != nullptr) {
+
+                    std::copy_n(values, columns, e.preActivation + static_cast<size_t>(row + i) * e.ldPreActivation + column);
+                }
+
+                if (e.act == activation::relu) {
+
+                    for (int j = 0; j < NR; j++) {
+                        values[j] = values[j] > 0 ? values[j] : 0.0f;
+                    }
+                }
+
+                else if (e.act == activation::gelu) {
+
+                    for (int j = 0; j < NR; j++) {
+                        values[j] = gelu(values[j]);
+                    }
+                }
+
+                if (e.derivativeOf != nullptr) {
+
+                    const float* dRow = e.derivativeOf + static_cast<size_t>(row + i) * e.ldDerivativeOf + column;
+
+                    for (int j = 0; j < columns; j++) {
+                        values[j] *= derivative(dRow[j], e.derivativeActivation);
+                    }
+                }
+            }
+
+            std::copy_n(values, columns, cRow);
+        }
+    }
+
+
+    static void microKernel(const int &depth, const float* a, const float* b, float (&tile)[MR][NR]) {
+
+        float accumulator[MR][NR]{};
+
+        for (int k = 0; k < depth; k++) {
+
+            const float* aColumn = a + k * MR;
+
+            const float* bRow = b + k * NR;
+
+            #pragma GCC unroll 6
+            for (int i = 0; i < MR; i++) {
+
+                const float aValue = aColumn[i];
+
+                for (int j = 0; j < NR; j++) {
+                    accumulator[i][j] += aValue * bRow[j];
+                }
+            }
+        }
+
+        for (int i = 0; i < MR; i++) {
+            for (int j = 0; j < NR; j++) {
+                tile[i][j] = accumulator[i][j];
+            }
+        }
+    }
+
+
+
+    static void multiplySmall(
+        const bool &transA,
+        const int &m,
+        const int &n,
+        const int &k,
+        const float* a,
+        const int &lda,
+        const float* b,
+        const int &ldb,
+        float* c,
+        const int &ldc,
+        const epilogue &e) {
+
+        threadPool::parallelFor((n + NG - 1) / NG, [&](const int item, int) {
+
+            const int groupStart = item * NG;
+
+            const int columns = std::min(NG, n - groupStart);
+
+            float accumulator[MR][NG]{};
+
+            float aColumn[MR];
+
+            for (int p = 0; p < k; p++) {
+
+                for (int i = 0; i < m; i++) {
+                    aColumn[i] = element(a, lda, transA, i, p);
+                }
+
+                const float* bRow = b + static_cast<size_t>(p) * ldb + groupStart;
+
+                for (int i = 0; i < m; i++) {
+                    for (int j = 0; j < columns; j++) {
+                        accumulator[i][j] += aColumn[i] * bRow[j];
+                    }
+                }
+            }
+
+            float tile[MR][NR];
+
+            for (int jr = 0; jr < columns; jr += NR) {
+
+                for (int i = 0; i < m; i++) {
+                    std::copy_n(accumulator[i] + jr, NR, tile[i]);
+                }
+
+                storeTile(tile, c, ldc, 0, groupStart + jr, m, std::min(NR, columns - jr), true, true, e);
+            }
+        });
+    }
+
+
+    static void multiply(
+        const bool &transA,
+        const bool &transB,
+        const int &m,
+        const int &n,
+        const int &k,
+        const float* a,
+        const int &lda,
+        const float* b,
+        const int &ldb,
+        float* c,
+        const int &ldc,
+        const epilogue &e) {
+
+        if (m <= 0 || n <= 0) {
+            return;
+        }
+
+        if (k <= 0) {
+
+            float zero[MR][NR]{};
+
+            for (int i = 0; i < m; i += MR) {
+                for (int j = 0; j < n; j += NR) {
+                    storeTile(zero, c, ldc, i, j, std::min(MR, m - i), std::min(NR, n - j), true, true, e);
+                }
+            }
+
+            return;
+        }
+
+        if (m <= MR && !transB) {
+
+            multiplySmall(transA, m, n, k, a, lda, b, ldb, c, ldc, e);
+
+            return;
+        }
+
+        thread_local std::vector<float> packedB;
+
+        thread_local std::vector<float> packedA;
+
+        for (int jc = 0; jc < n; jc += NC) {
+
+            const int nc = std::min(NC, n - jc);
+
+            const int slivers = (nc + NR - 1) / NR;
+
+            for (int pc = 0; pc < k; pc += KC) {
+
+                const int kc = std::min(KC, k - pc);
+
+                const bool first = pc == 0;
+
+                const bool last = pc + kc >= k;
+
+                packedB.resize(static_cast<size_t>(slivers) * kc * NR);
+
+                float* packedBData = packedB.data();
+
+                threadPool::parallelFor(slivers, [&](const int s, int) {
+
+                    packB(b, ldb, transB, pc, kc, jc + s * NR, std::min(NR, nc - s * NR), packedBData + static_cast<size_t>(s) * kc * NR);
+                });
+
+                const int rowBlocks = (m + MC - 1) / MC;
+
+                const int columnGroups = (nc + NG - 1) / NG;
+
+                threadPool::parallelFor(rowBlocks * columnGroups, [&](const int item, int) {
+
+                    const int ic = (item / columnGroups) * MC;
+
+                    const int mc = std::min(MC, m - ic);
+
+                    const int groupStart = (item % columnGroups) * NG;
+
+                    const int groupEnd = std::min(nc, groupStart + NG);
+
+                    packedA.resize(static_cast<size_t>((mc + MR - 1) / MR) * MR * kc);
+
+                    packA(a, lda, transA, ic, mc, pc, kc, packedA.data());
+
+                    float tile[MR][NR];
+
+                    for (int jr = groupStart; jr < groupEnd; jr += NR) {
+
+                        const float* bSliver = packedBData + static_cast<size_t>(jr / NR) * kc * NR;
+
+                        for (int ir = 0; ir < mc; ir += MR) {
+
+                            microKernel(kc, packedA.data() + static_cast<size_t>(ir) * kc, bSliver, tile);
+
+                            storeTile(tile, c, ldc, ic + ir, jc + jr, std::min(MR, mc - ir), std::min(NR, nc - jr), first, last, e);
+                        }
+                    }
+                });
+            }
+        }
+    }
+
+
+    static void multiply(
+        const bool &transA,
+        const bool &transB,
+        const int &m,
+        const int &n,
+        const int &k,
+        const float* a,
+        const int &lda,
+        const float* b,
+        const int &ldb,
+        float* c,
+        const int &ldc) {
+
+        multiply(transA, transB, m, n, k, a, lda, b, ldb, c, ldc, epilogue());
+    }
+
+
+    static void multiplyReference(
+        const bool &transA,
+        const bool &transB,
+        const int &m,
+        const int &n,
+        const int &k,
+        const float* a,
+        const int &lda,
+        const float* b,
+        const int &ldb,
+        float* c,
+        const int &ldc,
+        const epilogue &e) {
+
+        for (int i = 0; i < m; i++) {
+            for (int j = 0; j < n; j++) {
+
+                double sum = 0;
+
+                for (int p = 0; p < k; p++) {
+                    sum += static_cast<double>(element(a, lda, transA, i, p)) * element(b, ldb, transB, p, j);
+                }
+
+                float value = static_cast<float>(sum) + (e.accumulate ? c[static_cast<size_t>(i) * ldc + j] : 0.0f);
+
+                if (e.bias != nullptr) {
+                    value += e.bias[j];
+                }
+
+                if (e.preActivation != nullptr) {
+                    e.preActivation[static_cast<size_t>(i) * e.ldPreActivation + j] = value;
+                }
+
+                if (e.act == activation::relu) {
+                    value = std::max(value, 0.0f);
+                }
+
+                else if (e.act == activation::gelu) {
+                    value = 0.5f * value * (1.0f + std::tanh(0.7978845608f * (value + 0.044715f * value * value * value)));
+                }
+
+                if (e.derivativeOf != nullptr) {
+
+                    const float x = e.derivativeOf[static_cast<size_t>(i) * e.ldDerivativeOf + j];
+
+                    if (e.derivativeActivation == activation::relu) {
+                        value *= x > 0 ? 1.0f : 0.0f;
+                    }
+
+                    else if (e.derivativeActivation == activation::gelu) {
+                        value *= referenceGeluDerivative(x);
+                    }
+                }
+
+                c[static_cast<size_t>(i) * ldc + j] = value;
+            }
+        }
+    }
+
+
+    static void multiplyReference(
+        const bool &transA,
+        const bool &transB,
+        const int &m,
+        const int &n,
+        const int &k,
+        const float* a,
+        const int &lda,
+        const float* b,
+        const int &ldb,
+        float* c,
+        const int &ldc) {
+
+        multiplyReference(transA, transB, m, n, k, a, lda, b, ldb, c, ldc, epilogue());
+    }
+
+
+    static float referenceGeluDerivative(const float x) {
+
+        const float t = std::tanh(0.7978845608f * (x + 0.044715f * x * x * x));
+
+        return 0.5f * (1.0f + t) + 0.5f * x * (1.0f - t * t) * 0.7978845608f * (1.0f + 3.0f * 0.044715f * x * x);
+    }
+};
+
+
+
+
+#endif //GEMM_H
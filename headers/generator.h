@@ -0,0 +1,707 @@
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "attention.h"
+#include "detokenizer.h"
+#include "embedding.h"
+#include "feedForward.h"
+#include "tensor.h"
+#include "threadPool.h"
+#include "vocabularyImage.h"
+
+
+class generator {
+public:
+
+    struct block {
+
+        attention::weights attentionWeights;
+
+        feedForward::weights feedForwardWeights;
+    };
+
+
+    struct model {
+
+        int dModel = 0;
+
+        int heads = 0;
+
+        parameterPool pool;
+
+        tensor<float> embeddings;
+
+        std::vector<block> blocks;
+
+        vocabularyImage vocabulary;
+    };
+
+
+    struct cache {
+
+        int slots = 0;
+
+        int heads = 0;
+
+        int headDimension = 0;
+
+        int capacity = 0;
+
+        parameterPool pool;
+
+        std::vector<tensor<float>> keys;
+
+        std::vector<tensor<float>> values;
+
+        std::vector<int> lengths;
+    };
+
+
+    struct session {
+
+        arena scratch;
+
+        feedForward::activations feedForwardActivations;
+
+        std::vector<int> positions;
+    };
+
+
+
+    static void loadModel(model &m, const int &layers, const int &dModel, const int &heads, const int &dHidden, std::mt19937 &rng) {
+
+        if (dModel <= 0 || heads <= 0 || dModel % heads != 0) {
+            throw std::runtime_error("generator : dModel " + std::to_string(dModel) + " is not divisible into " + std::to_string(heads) + " heads");
+        }
+
+        m.dModel = dModel;
+
+        m.heads = heads;
+
+        vocabularyImage::load(m.vocabulary);
+
+        std::ifstream embeddingsFileIn("../output/embeddings.bin", std::ios::binary);
+
+        if (embeddingsFileIn) {
+            embedding::loadEmbeddings(embeddingsFileIn, dModel, m.vocabulary.size(), m.pool, m.embeddings);
+        }
+
+        else {
+
+            std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+            m.embeddings = m.pool.allocateRows<float>(m.vocabulary.size(), dModel);
+
+            for (int i = 0; i < m.vocabulary.size(); i++) {
+                for (int j = 0; j < dModel; j++) {
+                    m.embeddings(i, j) = dist(rng);
+                }
+            }
+        }
+
+        m.blocks.resize(layers);
+
+        for (auto& i : m.blocks) {
+
+            attention::initializeWeights(i.attentionWeights, dModel, heads, rng);
+
+            feedForward::initializeWeights(i.feedForwardWeights, dModel, dHidden, gemm::activation::gelu, rng);
+        }
+    }
+
+
+    static void initializeCache(cache &c, const model &m, const int &slots, const int &capacity) {
+
+        c.slots = slots;
+
+        c.heads = m.heads;
+
+        c.headDimension = m.dModel / m.heads;
+
+        c.capacity = capacity;
+
+        for (size_t l = 0; l < m.blocks.size(); l++) {
+
+            c.keys.push_back(c.pool.allocate<float>({slots, c.heads, capacity, c.headDimension}));
+
+            c.values.push_back(c.pool.allocate<float>({slots, c.heads, capacity, c.headDimension}));
+        }
+
+        c.lengths.assign(slots, 0);
+    }
+
+
+    static size_t bytesPerCachedToken(const cache &c) {
+        return 2 * c.keys.size() * static_cast<size_t>(c.heads) * c.headDimension * sizeof(float);
+    }
+
+
+
+    static void rmsNorm(const float* x, float* y, const int &rows, const int &dModel) {
+
+        for (int r = 0; r < rows; r++) {
+
+            const float* xRow = x + static_cast<size_t>(r) * dModel;
+
+            float* yRow = y + static_cast<size_t>(r) * dModel;
+
+            const float inverse = 1.0f / std::sqrt(embedding::dotProduct(xRow, xRow, dModel) / dModel + 1e-5f);
+
+            for (int i = 0; i < dModel; i++) {
+                yRow[i] = xRow[i] * inverse;
+            }
+        }
+    }
+
+
+    static void embedTokens(const model &m, const std::vector<int> &tokens, const std::vector<int> &positions, float* x) {
+
+        for (size_t r = 0; r < tokens.size(); r++) {
+
+            float* xRow = x + r * m.dModel;
+
+            const float* eRow = m.embeddings.row(tokens[r]);
+
+            for (int i = 0; i < m.dModel; i += 2) {
+
+                const float angle = positions[r] / std::pow(10000.0f, static_cast<float>(i) / m.dModel);
+
+                xRow[i] = eRow[i] + std::sin(angle);
+
+                if (i + 1 < m.dModel) {
+                    xRow[i + 1] = eRow[i + 1] + std::cos(angle);
+                }
+            }
+        }
+    }
+
+
+    static void attendCached(
+        const cache &c,
+        const int &layer,
+        const int &slot,
+        const int &h,
+        const int &position,
+        const float* q,
+        float* o,
+        float* scores) {
+
+        const float scale = 1.0f / std::sqrt(static_cast<float>(c.headDimension));
+
+        const float* keys = &c.keys[layer](slot, h, 0);
+
+        const float* values = &c.values[layer](slot, h, 0);
+
+        const float* qHead = q + static_cast<size_t>(h) * c.headDimension;
+
+        float* oHead = o + static_cast<size_t>(h) * c.headDimension;
+
+        float maximum = -std::numeric_limits<float>::infinity();
+
+        for (int j = 0; j <= position; j++) {
+
+            scores[j] = embedding::dotProduct(keys + static_cast<size_t>(j) * c.headDimension, qHead, c.headDimension) * scale;
+
+            maximum = std::max(maximum, scores[j]);
+        }
+
+        float sum = 0;
+
+        std::fill(oHead, oHead + c.headDimension, 0.0f);
+
+        for (int j = 0; j <= position; j++) {
+
+            const float p = std::exp(scores[j] - maximum);
+
+            sum += p;
+
+            const float* vRow = values + static_cast<size_t>(j) * c.headDimension;
+
+            for (int d = 0; d < c.headDimension; d++) {
+                oHead[d] += p * vRow[d];
+            }
+        }
+
+        const float inverse = 1.0f / sum;
+
+        for (int d = 0; d < c.headDimension; d++) {
+            oHead[d] *= inverse;
+        }
+    }
+
+
+
+    static void computeLogits(const model &m, const float* x, const int &rows, float* logits) {
+
+        const int size = static_cast<int>(m.embeddings.shape[0]);
+
+        const int vectorEnd = m.dModel - m.dModel % 16;
+
+        constexpr int chunk = 1024;
+
+        threadPool::parallelFor((size + chunk - 1) / chunk, [&](const int item, int) {
+
+            const int end = std::min(size, (item + 1) * chunk);
+
+            for (int t = item * chunk; t < end; t += 4) {
+
+                const float* e0 = m.embeddings.row(t);
+                const float* e1 = m.embeddings.row(std::min(t + 1, end - 1));
+                const float* e2 = m.embeddings.row(std::min(t + 2, end - 1));
+                const float* e3 = m.embeddings.row(std::min(t + 3, end - 1));
+
+                for (int r = 0; r < rows; r++) {
+
+                    const float* xRow = x + static_cast<size_t>(r) * m.dModel;
+
+                    float s0[16]{}, s1[16]{}, s2[16]{}, s3[16]{};
+
+                    for (int d = 0; d < vectorEnd; d += 16) {
+                        for (int j = 0; j < 16; j++) {
+
+                            s0[j] += e0[d + j] * xRow[d + j];
+                            s1[j] += e1[d + j] * xRow[d + j];
+                            s2[j] += e2[d + j] * xRow[d + j];
+                            s3[j] += e3[d + j] * xRow[d + j];
+                        }
+                    }
+
+                    for (int d = vectorEnd; d < m.dModel; d++) {
+
+                        s0[0] += e0[d] * xRow[d];
+                        s1[0] += e1[d] * xRow[d];
+                        s2[0] += e2[d] * xRow[d];
+                        s3[0] += e3[d] * xRow[d];
+                    }
+
+                    float sums[4]{};
+
+                    for (int j = 0; j < 16; j++) {
+
+                        sums[0] += s0[j];
+                        sums[1] += s1[j];
+                        sums[2] += s2[j];
+                        sums[3] += s3[j];
+                    }
+
+                    for (int g = 0; g < 4 && t + g < end; g++) {
+                        logits[static_cast<size_t>(r) * size + t + g] = sums[g];
+                    }
+                }
+            }
+        });
+    }
+
+
+    static void step(
+        const model &m,
+        cache &c,
+        session &s,
+        const std::vector<int> &slots,
+        const std::vector<int> &tokens,
+        std::vector<float> &logits) {
+
+        const int rows = static_cast<int>(tokens.size());
+
+        const int dModel = m.dModel;
+
+        s.positions.resize(rows);
+
+        if (slots.size() != tokens.size()) {
+            throw std::runtime_error("generator : " + std::to_string(slots.size()) + " slots for " + std::to_string(rows) + " tokens");
+        }
+
+        for (int r = 0; r < rows; r++) {
+
+            if (slots[r] < 0 || slots[r] >= c.slots || c.lengths[slots[r]] >= c.capacity) {
+
+                for (int i = 0; i < r; i++) {
+                    c.lengths[slots[i]]--;
+                }
+
+                throw std::runtime_error(slots[r] < 0 || slots[r] >= c.slots
+                    ? "generator : slot " + std::to_string(slots[r]) + " out of range"
+                    : "generator : sequence exceeds the cache capacity");
+            }
+
+            s.positions[r] = c.lengths[slots[r]]++;
+        }
+
+        const arena::marker mark = s.scratch.mark();
+
+        float* h = s.scratch.allocateArray<float>(static_cast<size_t>(rows) * dModel);
+
+        float* normed = s.scratch.allocateArray<float>(static_cast<size_t>(rows) * dModel);
+
+        float* q = s.scratch.allocateArray<float>(static_cast<size_t>(rows) * dModel);
+
+        float* k = s.scratch.allocateArray<float>(static_cast<size_t>(rows) * dModel);
+
+        float* v = s.scratch.allocateArray<float>(static_cast<size_t>(rows) * dModel);
+
+        float* o = s.scratch.allocateArray<float>(static_cast<size_t>(rows) * dModel);
+
+        float* scores = s.scratch.allocateArray<float>(static_cast<size_t>(threadPool::instance().size()) * c.capacity);
+
+        embedTokens(m, tokens, s.positions, h);
+
+        for (size_t l = 0; l < m.blocks.size(); l++) {
+
+            const attention::weights &aw = m.blocks[l].attentionWeights;
+
+            rmsNorm(h, normed, rows, dModel);
+
+            attention::project(normed, aw.query.data(), q, rows, dModel, dModel);
+
+            attention::project(normed, aw.key.data(), k, rows, dModel, dModel);
+
+            attention::project(normed, aw.value.data(), v, rows, dModel, dModel);
+
+            for (int r = 0; r < rows; r++) {
+                for (int hd = 0; hd < c.heads; hd++) {
+
+                    std::copy_n(k + static_cast<size_t>(r) * dModel + hd * c.headDimension, c.headDimension, &c.keys[l](slots[r], hd, s.positions[r]));
+
+                    std::copy_n(v + static_cast<size_t>(r) * dModel + hd * c.headDimension, c.headDimension, &c.values[l](slots[r], hd, s.positions[r]));
+                }
+            }
+
+            threadPool::parallelFor(rows * c.heads, [&](const int item, const int thread) {
+
+                const int r = item / c.heads;
+
+                attendCached(c, l, slots[r], item % c.heads, s.positions[r], q + static_cast<size_t>(r) * dModel, o + static_cast<size_t>(r) * dModel, scores + static_cast<size_t>(thread) * c.capacity);
+            });
+
+            gemm::epilogue residual;
+
+            residual.accumulate = true;
+
+            gemm::multiply(false, false, rows, dModel, dModel, o, dModel, aw.output.data(), dModel, h, dModel, residual);
+
+            rmsNorm(h, normed, rows, dModel);
+
+            feedForward::forward(m.blocks[l].feedForwardWeights, normed, rows, s.feedForwardActivations, o, false);
+
+            for (size_t i = 0; i < static_cast<size_t>(rows) * dModel; i++) {
+                h[i] += o[i];
+            }
+        }
+
+        rmsNorm(h, normed, rows, dModel);
+
+        logits.resize(static_cast<size_t>(rows) * m.embeddings.shape[0]);
+
+        computeLogits(m, normed, rows, logits.data());
+
+        s.scratch.rewind(mark);
+    }
+
+
+    static int argMax(const std::vector<float> &logits, const int &row, const int &size) {
+
+        const float* begin = logits.data() + static_cast<size_t>(row) * size;
+
+        return static_cast<int>(std::max_element(begin, begin + size) - begin);
+    }
+
+
+
+    static void generate(
+        const model &m,
+        cache &c,
+        session &s,
+        const std::vector<std::vector<int>> &prompts,
+        const int &newTokens,
+        std::vector<std::vector<int>> &outputs,
+        std::vector<double>* stepSeconds = nullptr,
+        const std::function<void(int, int)> &onToken = {}) {
+
+        const int size = static_cast<int>(m.embeddings.shape[0]);
+
+        std::vector<float> logits;
+
+        std::vector<int> slots;
+
+        std::vector<int> tokens;
+
+        outputs.assign(prompts.size(), {});
+
+        std::fill(c.lengths.begin(), c.lengths.end(), 0);
+
+        for (size_t p = 0; p < prompts.size(); p++) {
+
+            slots.assign(prompts[p].size(), static_cast<int>(p));
+
+            step(m, c, s, slots, prompts[p], logits);
+
+            outputs[p].push_back(argMax(logits, static_cast<int>(prompts[p].size()) - 1, size));
+
+            if (onToken) {
+                onToken(static_cast<int>(p), outputs[p].back());
+            }
+        }
+
+        slots.resize(prompts.size());
+
+        tokens.resize(prompts.size());
+
+        for (size_t p = 0; p < prompts.size(); p++) {
+            slots[p] = static_cast<int>(p);
+        }
+
+        for (int t = 1; t < newTokens; t++) {
+
+            for (size_t p = 0; p < prompts.size(); p++) {
+                tokens[p] = outputs[p].back();
+            }
+
+            const auto start = std::chrono::high_resolution_clock::now();
+
+            step(m, c, s, slots, tokens, logits);
+
+            const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+            if (stepSeconds != nullptr) {
+                stepSeconds->push_back(elapsed.count());
+            }
+
+            for (size_t p = 0; p < prompts.size(); p++) {
+
+                outputs[p].push_back(argMax(logits, static_cast<int>(p), size));
+
+                if (onToken) {
+                    onToken(static_cast<int>(p), outputs[p].back());
+                }
+            }
+        }
+    }
+
+
+    static void encodePrompt(const model &m, const std::string &text, std::vector<int> &tokens) {
+
+        std::vector<std::string> words;
+
+        embedding::splitWords(text, words);
+
+        tokens.clear();
+
+        vocabularyImage::tokenizeWords(words, m.vocabulary, tokens);
+
+        if (tokens.empty()) {
+            tokens.push_back(0);
+        }
+    }
+
+
+
+    static void run(const std::vector<std::string> &prompts, const int &newTokens) {
+
+        std::mt19937 rng(42);
+
+        model m;
+
+        loadModel(m, 4, 512, 8, 2048, rng);
+
+        std::vector<std::vector<int>> encoded(prompts.size());
+
+        int longest = 0;
+
+        for (size_t p = 0; p < prompts.size(); p++) {
+
+            encodePrompt(m, prompts[p], encoded[p]);
+
+            longest = std::max(longest, static_cast<int>(encoded[p].size()));
+        }
+
+        cache c;
+
+        initializeCache(c, m, static_cast<int>(prompts.size()), longest + newTokens);
+
+        session s;
+
+        detokenizer d;
+
+        detokenizer::fromImage(m.vocabulary, d);
+
+        std::vector<detokenizer::stream> streams(prompts.size());
+
+        std::vector<std::string> texts(prompts.size());
+
+        std::vector<std::vector<int>> outputs;
+
+        const bool live = prompts.size() == 1;
+
+        if (live) {
+            std::cout << prompts[0] << " -> " << std::flush;
+        }
+
+        generate(m, c, s, encoded, newTokens, outputs, nullptr, [&](const int p, const int token) {
+
+            detokenizer::push(d, streams[p], token);
+
+            if (live) {
+                std::cout << detokenizer::pending(streams[p]) << std::flush;
+            }
+
+            else {
+                texts[p] += detokenizer::pending(streams[p]);
+            }
+
+            detokenizer::consume(streams[p]);
+        });
+
+        if (live) {
+            std::cout << "\n";
+        }
+
+        for (size_t p = 0; !live && p < prompts.size(); p++) {
+            std::cout << prompts[p] << " -> " << texts[p] << "\n";
+        }
+    }
+
+
+    static void benchmark(const int &promptLength) {
+
+        constexpr int newTokens = 64;
+
+        constexpr int recomputeTokens = 16;
+
+        std::mt19937 rng(42);
+
+        model m;
+
+        loadModel(m, 4, 512, 8, 2048, rng);
+
+        const int size = static_cast<int>(m.embeddings.shape[0]);
+
+        std::uniform_int_distribution tokenDist(0, size - 1);
+
+        session s;
+
+        std::cout << "batch,prompt_tokens,ms_per_step_p50,ms_per_token,tokens_per_s,cache_bytes_per_token,cache_mb\n";
+
+        for (const int batch : {1, 4, 16}) {
+
+            std::vector<std::vector<int>> prompts(batch, std::vector<int>(promptLength));
+
+            for (auto& i : prompts) {
+                for (auto& j : i) {
+                    j = tokenDist(rng);
+                }
+            }
+
+            cache c;
+
+            initializeCache(c, m, batch, promptLength + newTokens);
+
+            std::vector<std::vector<int>> outputs;
+
+            std::vector<double> stepSeconds;
+
+            generate(m, c, s, prompts, newTokens, outputs, &stepSeconds);
+
+            std::sort(stepSeconds.begin(), stepSeconds.end());
+
+            const double median = stepSeconds[stepSeconds.size() / 2];
+
+            std::cout << batch << "," << promptLength << "," << median * 1e3 << "," << median * 1e3 / batch << "," << batch / median << ","
+            << bytesPerCachedToken(c) << "," << c.pool.bytes / (1024.0 * 1024.0) << "\n";
+        }
+
+
+        std::vector<std::vector<int>> prompt(1, std::vector<int>(promptLength));
+
+        for (auto& i : prompt[0]) {
+            i = tokenDist(rng);
+        }
+
+        cache c;
+
+        initializeCache(c, m, 1, promptLength + recomputeTokens);
+
+        std::vector<std::vector<int>> outputs;
+
+        std::vector<double> stepSeconds;
+
+        generate(m, c, s, prompt, recomputeTokens, outputs, &stepSeconds);
+
+        std::vector<float> cachedLogits(size);
+
+        std::vector<float> logits;
+
+        std::vector<int> sequence = prompt[0];
+
+        std::vector<int> slots;
+
+        int matches = 0;
+
+        float maxDifference = 0;
+
+        double recomputeSeconds = 0;
+
+        for (int t = 0; t < recomputeTokens; t++) {
+
+            c.lengths[0] = 0;
+
+            slots.assign(sequence.size(), 0);
+
+            const auto start = std::chrono::high_resolution_clock::now();
+
+            step(m, c, s, slots, sequence, logits);
+
+            const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+            if (t > 0) {
+                recomputeSeconds += elapsed.count();
+            }
+
+            const int last = static_cast<int>(sequence.size()) - 1;
+
+            matches += argMax(logits, last, size) == outputs[0][t];
+
+            if (t == recomputeTokens - 1) {
+
+                c.lengths[0] = last;
+
+                slots.assign(1, 0);
+
+                step(m, c, s, slots, {sequence.back()}, cachedLogits);
+
+                for (int i = 0; i < size; i++) {
+                    maxDifference = std::max(maxDifference, std::abs(cachedLogits[i] - logits[static_cast<size_t>(last) * size + i]));
+                }
+            }
+
+            sequence.push_back(outputs[0][t]);
+        }
+
+        double cachedSeconds = 0;
+
+        for (const auto& i : stepSeconds) {
+            cachedSeconds += i;
+        }
+
+        std::cout << "recompute ms_per_token : " << recomputeSeconds / (recomputeTokens - 1) * 1e3
+        << ", cached ms_per_token : " << cachedSeconds / stepSeconds.size() * 1e3
+        << ", matching tokens : " << matches << "/" << recomputeTokens
+        << ", max logit difference : " << maxDifference << "\n";
+    }
+};
+
+
+
+
+#endif //GENERATOR_H
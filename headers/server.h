@@ -0,0 +1,659 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "embedding.h"
+#include "threadPool.h"
+
+
+class server {
+public:
+
+    static constexpr int dimension = 512;
+
+    static constexpr int maxBatchSize = 64;
+
+    static constexpr size_t maxLineBytes = 1 << 20;
+
+    static constexpr auto gatherWindow = std::chrono::microseconds(200);
+
+
+
+    struct model {
+
+        const float* embeddings = nullptr;
+
+        size_t mappedBytes = 0;
+
+        vocabularyImage vocabulary;
+    };
+
+
+    struct request {
+
+        std::string line;
+
+        std::promise<std::string> response;
+    };
+
+
+    struct requestQueue {
+
+        std::mutex mutex;
+
+        std::condition_variable condition;
+
+        std::deque<request*> requests;
+
+        int connections = 0;
+
+        std::atomic<std::uint64_t> batches = 0;
+
+        std::atomic<std::uint64_t> batched = 0;
+    };
+
+
+    class lineReader {
+    public:
+
+        int fd;
+
+        std::string buffer;
+
+        size_t position = 0;
+
+        bool tooLong = false;
+
+        explicit lineReader(const int fd) : fd(fd) {}
+
+        bool readLine(std::string &line) {
+
+            while (true) {
+
+                const size_t newline = buffer.find('\n', position);
+
+                if (newline != std::string::npos) {
+
+                    line.assign(buffer, position, newline - position);
+
+                    position = newline + 1;
+
+                    return true;
+                }
+
+                buffer.erase(0, position);
+
+                position = 0;
+
+                if (buffer.size() > maxLineBytes) {
+
+                    tooLong = true;
+
+                    return false;
+                }
+
+                char chunk[65536];
+
+                const ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+
+                if (received <= 0) {
+                    return false;
+                }
+
+                buffer.append(chunk, received);
+            }
+        }
+    };
+
+
+
+    static bool sendAll(const int &fd, const std::string &data) {
+
+        size_t sent = 0;
+
+        while (sent < data.size()) {
+
+            const ssize_t written = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+
+            if (written <= 0) {
+                return false;
+            }
+
+            sent += written;
+        }
+
+        return true;
+    }
+
+
+    static sockaddr_un socketAddress(const std::string &socketPath) {
+
+        sockaddr_un address{};
+
+        address.sun_family = AF_UNIX;
+
+        if (socketPath.size() >= sizeof(address.sun_path)) {
+            throw std::runtime_error("server : socket path too long");
+        }
+
+        std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+        return address;
+    }
+
+
+
+    static void loadModel(model &m) {
+
+        vocabularyImage::load(m.vocabulary);
+
+
+        const int fd = open("../output/embeddings.bin", O_RDONLY);
+
+        if (fd < 0) {
+            throw std::runtime_error("server : cannot open embeddings.bin");
+        }
+
+        struct stat status{};
+
+        fstat(fd, &status);
+
+        m.mappedBytes = status.st_size;
+
+        if (m.mappedBytes != static_cast<size_t>(m.vocabulary.size()) * dimension * sizeof(float)) {
+            throw std::runtime_error("server : embeddings.bin does not match the vocabulary");
+        }
+
+        void* mapped = mmap(nullptr, m.mappedBytes, PROT_READ, MAP_SHARED, fd, 0);
+
+        close(fd);
+
+        if (mapped == MAP_FAILED) {
+            throw std::runtime_error("server : cannot map embeddings.bin");
+        }
+
+        madvise(mapped, m.mappedBytes, MADV_WILLNEED);
+
+        m.embeddings = static_cast<const float*>(mapped);
+    }
+
+
+
+    static bool meanPool(const model &m, const std::string_view &text, float* pooled) {
+
+        thread_local std::vector<std::string> words;
+
+        thread_local std::vector<int> tokens;
+
+        words.clear();
+
+        tokens.clear();
+
+        embedding::splitWords(text, words);
+
+        vocabularyImage::tokenizeWords(words, m.vocabulary, tokens);
+
+        std::fill(pooled, pooled + dimension, 0.0f);
+
+        if (tokens.empty()) {
+            return false;
+        }
+
+        for (const auto& token : tokens) {
+
+            const float* row = m.embeddings + static_cast<size_t>(token) * dimension;
+
+            for (int i = 0; i < dimension; i++) {
+
+                pooled[i] += row[i];
+            }
+        }
+
+        const float scale = 1.0f / static_cast<float>(tokens.size());
+
+        for (int i = 0; i < dimension; i++) {
+
+            pooled[i] *= scale;
+        }
+
+        return true;
+    }
+
+
+    static void appendVector(std::string &response, const float* vector) {
+
+        char number[32];
+
+        for (int i = 0; i < dimension; i++) {
+
+            const auto result = std::to_chars(number, number + sizeof(number), vector[i]);
+
+            if (i != 0) {
+                response += ' ';
+            }
+
+            response.append(number, result.ptr);
+        }
+    }
+
+
+    static void answerBatch(const model &m, const std::vector<request*> &batch, std::vector<float> &pooled) {
+
+        std::vector<std::string_view> texts;
+
+        std::vector<int> firstRows(batch.size(), -1);
+
+        std::vector<int> secondRows(batch.size(), -1);
+
+        std::vector<std::string> responses(batch.size());
+
+
+        for (size_t b = 0; b < batch.size(); b++) {
+
+            const std::string &line = batch[b]->line;
+
+            const size_t space = line.find(' ');
+
+            const std::string_view command = std::string_view(line).substr(0, space);
+
+            const std::string_view argument = space == std::string::npos ? std::string_view() : std::string_view(line).substr(space + 1);
+
+            if (command == "LOOKUP") {
+
+                const int token = m.vocabulary.find(argument);
+
+                if (token < 0) {
+                    responses[b] = "ERROR unknown token\n";
+                }
+
+                else {
+                    appendVector(responses[b], m.embeddings + static_cast<size_t>(token) * dimension);
+                    responses[b] += '\n';
+                }
+            }
+
+            else if (command == "SENTENCE") {
+
+                firstRows[b] = static_cast<int>(texts.size());
+
+                texts.push_back(argument);
+            }
+
+            else if (command == "SIMILARITY") {
+
+                const size_t tab = argument.find('\t');
+
+                if (tab == std::string_view::npos) {
+                    responses[b] = "ERROR expected two texts separated by a tab\n";
+                    continue;
+                }
+
+                firstRows[b] = static_cast<int>(texts.size());
+
+                texts.push_back(argument.substr(0, tab));
+
+                secondRows[b] = static_cast<int>(texts.size());
+
+                texts.push_back(argument.substr(tab + 1));
+            }
+
+            else {
+                responses[b] = "ERROR unknown command\n";
+            }
+        }
+
+
+        pooled.resize(texts.size() * dimension);
+
+        std::vector<std::uint8_t> found(texts.size());
+
+        threadPool::parallelFor(static_cast<int>(texts.size()), [&](const int t, int) {
+            found[t] = meanPool(m, texts[t], pooled.data() + static_cast<size_t>(t) * dimension);
+        });
+
+
+        for (size_t b = 0; b < batch.size(); b++) {
+
+            if (firstRows[b] >= 0 && (!found[firstRows[b]] || (secondRows[b] >= 0 && !found[secondRows[b]]))) {
+                responses[b] = "ERROR no tokens\n";
+            }
+
+            else if (secondRows[b] >= 0) {
+
+                const float* first = pooled.data() + static_cast<size_t>(firstRows[b]) * dimension;
+
+                const float* second = pooled.data() + static_cast<size_t>(secondRows[b]) * dimension;
+
+                const float norms = std::sqrt(embedding::dotProduct<dimension>(first, first) * embedding::dotProduct<dimension>(second, second));
+
+                responses[b] = std::to_string(norms > 0 ? embedding::dotProduct<dimension>(first, second) / norms : 0.0f) + "\n";
+            }
+
+            else if (firstRows[b] >= 0) {
+
+                appendVector(responses[b], pooled.data() + static_cast<size_t>(firstRows[b]) * dimension);
+
+                responses[b] += '\n';
+            }
+
+            batch[b]->response.set_value(std::move(responses[b]));
+        }
+    }
+
+
+
+    static void batchWorker(const model &m, requestQueue &queue) {
+
+        std::vector<request*> batch;
+
+        std::vector<float> pooled;
+
+        while (true) {
+
+            {
+                std::unique_lock lock(queue.mutex);
+
+                queue.condition.wait(lock, [&] { return !queue.requests.empty(); });
+
+                const auto deadline = std::chrono::steady_clock::now() + gatherWindow;
+
+                queue.condition.wait_until(lock, deadline, [&] {
+                    return static_cast<int>(queue.requests.size()) >= std::min(maxBatchSize, queue.connections);
+                });
+
+                while (!queue.requests.empty() && batch.size() < maxBatchSize) {
+
+                    batch.push_back(queue.requests.front());
+
+                    queue.requests.pop_front();
+                }
+            }
+
+            queue.batches++;
+
+            queue.batched += batch.size();
+
+            answerBatch(m, batch, pooled);
+
+            batch.clear();
+        }
+    }
+
+
+    static void serveConnection(const int fd, requestQueue &queue) {
+
+        lineReader reader(fd);
+
+        request r;
+
+        {
+            std::lock_guard lock(queue.mutex);
+
+            queue.connections++;
+        }
+
+        while (reader.readLine(r.line)) {
+
+            if (r.line == "STATS") {
+
+                if (!sendAll(fd, std::to_string(queue.batches.load()) + " " + std::to_string(queue.batched.load()) + "\n")) {
+                    break;
+                }
+
+                continue;
+            }
+
+            r.response = std::promise<std::string>();
+
+            std::future<std::string> response = r.response.get_future();
+
+            {
+                std::lock_guard lock(queue.mutex);
+
+                queue.requests.push_back(&r);
+            }
+
+            queue.condition.notify_one();
+
+            if (!sendAll(fd, response.get())) {
+                break;
+            }
+        }
+
+        if (reader.tooLong) {
+            sendAll(fd, "ERROR line longer than " + std::to_string(maxLineBytes) + " bytes\n");
+        }
+
+        {
+            std::lock_guard lock(queue.mutex);
+
+            queue.connections--;
+        }
+
+        close(fd);
+    }
+
+
+    static void serve(const std::string &socketPath) {
+
+        model m;
+
+        loadModel(m);
+
+        requestQueue queue;
+
+        std::thread(batchWorker, std::cref(m), std::ref(queue)).detach();
+
+
+        const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (listener < 0) {
+            throw std::runtime_error("server : cannot create a socket");
+        }
+
+        const sockaddr_un address = socketAddress(socketPath);
+
+        unlink(socketPath.c_str());
+
+        if (bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 1024) != 0) {
+            throw std::runtime_error("server : cannot listen on " + socketPath);
+        }
+
+        std::cout << "listening on " << socketPath << " (" << m.vocabulary.size() << " tokens, one batcher, pooling on " << threadPool::instance().size() << " threads)\n";
+
+        std::cout.flush();
+
+        while (true) {
+
+            const int fd = accept(listener, nullptr, nullptr);
+
+            if (fd < 0) {
+                continue;
+            }
+
+            std::thread(serveConnection, fd, std::ref(queue)).detach();
+        }
+    }
+
+
+
+    static int connectTo(const std::string &socketPath) {
+
+        const sockaddr_un address = socketAddress(socketPath);
+
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (fd < 0) {
+            throw std::runtime_error("server : cannot create a socket");
+        }
+
+        if (connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+
+            close(fd);
+
+            throw std::runtime_error("server : cannot connect to " + socketPath);
+        }
+
+        return fd;
+    }
+
+
+    static bool readStats(const std::string &socketPath, std::uint64_t &batches, std::uint64_t &batched) {
+
+        try {
+
+            const int fd = connectTo(socketPath);
+
+            lineReader reader(fd);
+
+            std::string line;
+
+            const bool answered = sendAll(fd, "STATS\n") && reader.readLine(line);
+
+            close(fd);
+
+            std::istringstream fields(line);
+
+            return answered && static_cast<bool>(fields >> batches >> batched);
+        }
+
+        catch (const std::exception &) {
+            return false;
+        }
+    }
+
+
+    static void loadTest(const std::string &socketPath) {
+
+        const std::vector<std::string> requests = {
+            "LOOKUP the",
+            "SENTENCE the quick brown fox jumps over the lazy dog",
+            "SIMILARITY paris is the capital of france\tberlin is the capital of germany",
+            "LOOKUP and",
+            "SENTENCE a transformer is a deep learning architecture based on attention",
+            "SIMILARITY the cat sat on the mat\tstock markets fell sharply today"
+        };
+
+        constexpr double secondsPerLevel = 2.0;
+
+        const int concurrencyLevels[] = {1, 4, 16, 64};
+
+        std::cout << "concurrency,qps,mean_batch,p50_us,p99_us,p999_us,errors,failed_clients\n";
+
+        for (const int concurrency : concurrencyLevels) {
+
+            std::vector<std::vector<double>> latencies(concurrency);
+
+            std::vector<size_t> errors(concurrency);
+
+            std::vector<std::string> failures(concurrency);
+
+            std::vector<std::thread> clients;
+
+            std::uint64_t batchesBefore = 0, batchedBefore = 0, batchesAfter = 0, batchedAfter = 0;
+
+            const bool stats = readStats(socketPath, batchesBefore, batchedBefore);
+
+            const auto start = std::chrono::high_resolution_clock::now();
+
+            for (int c = 0; c < concurrency; c++) {
+
+                clients.emplace_back([&, c] {
+
+                    int fd;
+
+                    try {
+                        fd = connectTo(socketPath);
+                    }
+
+                    catch (const std::exception &e) {
+
+                        failures[c] = e.what();
+
+                        return;
+                    }
+
+                    lineReader reader(fd);
+
+                    std::string line;
+
+                    for (size_t i = c; std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() < secondsPerLevel; i++) {
+
+                        const auto sent = std::chrono::high_resolution_clock::now();
+
+                        if (!sendAll(fd, requests[i % requests.size()] + "\n") || !reader.readLine(line)) {
+                            break;
+                        }
+
+                        latencies[c].push_back(std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - sent).count());
+
+                        if (line.starts_with("ERROR")) {
+                            errors[c]++;
+                        }
+                    }
+
+                    close(fd);
+                });
+            }
+
+            for (auto& i : clients) {
+                i.join();
+            }
+
+            const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+            const double meanBatch = stats && readStats(socketPath, batchesAfter, batchedAfter) && batchesAfter > batchesBefore
+            ? static_cast<double>(batchedAfter - batchedBefore) / static_cast<double>(batchesAfter - batchesBefore) : 0.0;
+
+            std::vector<double> all;
+
+            size_t errorCount = 0;
+
+            int failedClients = 0;
+
+            for (int c = 0; c < concurrency; c++) {
+
+                all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+
+                errorCount += errors[c];
+
+                if (!failures[c].empty()) {
+
+                    std::cerr << "client " << c << " : " << failures[c] << "\n";
+
+                    failedClients++;
+                }
+            }
+
+            std::sort(all.begin(), all.end());
+
+            auto percentile = [&](const double p) {
+                return all.empty() ? 0.0 : all[std::min(all.size() - 1, static_cast<size_t>(p * all.size()))];
+            };
+
+            std::cout << concurrency << "," << all.size() / elapsed.count() << "," << meanBatch << ","
+            << percentile(0.5) << "," << percentile(0.99) << "," << percentile(0.999) << "," << errorCount << "," << failedClients << "\n";
+        }
+    }
+};
+
+
+
+
+#endif //SERVER_H
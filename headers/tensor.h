@@ -0,0 +1,409 @@
+#ifndef TENSOR_H
+#define TENSOR_H
+
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <new>
+#include <vector>
+
+
+class allocationCounter {
+public:
+
+    inline static std::atomic<std::uint64_t> heapAllocations = 0;
+
+
+    static std::uint64_t count() {
+        return heapAllocations.load(std::memory_order_relaxed);
+    }
+};
+
+
+
+template<typename T>
+class tensor {
+public:
+
+    static constexpr int maxRank = 4;
+
+    T* data = nullptr;
+
+    int rank = 0;
+
+    std::array<std::int64_t, maxRank> shape{};
+
+    std::array<std::int64_t, maxRank> strides{};
+
+
+
+    tensor() = default;
+
+
+    tensor(T* data, const std::initializer_list<std::int64_t> &dimensions) : data(data), rank(static_cast<int>(dimensions.size())) {
+
+        std::copy(dimensions.begin(), dimensions.end(), shape.begin());
+
+        std::int64_t stride = 1;
+
+        for (int i = rank - 1; i >= 0; i--) {
+
+            strides[i] = stride;
+
+            stride *= shape[i];
+        }
+    }
+
+
+    std::int64_t size() const {
+
+        std::int64_t elements = 1;
+
+        for (int i = 0; i < rank; i++) {
+            elements *= shape[i];
+        }
+
+        return elements;
+    }
+
+
+    bool contiguous() const {
+
+        std::int64_t stride = 1;
+
+        for (int i = rank - 1; i >= 0; i--) {
+
+            if (shape[i] != 1 && strides[i] != stride) {
+                return false;
+            }
+
+            stride *= shape[i];
+        }
+
+        return true;
+    }
+
+
+    T* row(const std::int64_t &i) const {
+        return data + i * strides[0];
+    }
+
+
+    T &operator()(const std::int64_t &i) const {
+        return data[i * strides[0]];
+    }
+
+
+    T &operator()(const std::int64_t &i, const std::int64_t &j) const {
+        return data[i * strides[0] + j * strides[1]];
+    }
+
+
+    T &operator()(const std::int64_t &i, const std::int64_t &j, const std::int64_t &k) const {
+        return data[i * strides[0] + j * strides[1] + k * strides[2]];
+    }
+
+
+
+    tensor operator[](const std::int64_t &i) const {
+
+        tensor view;
+
+        view.data = row(i);
+
+        view.rank = rank - 1;
+
+        std::copy(shape.begin() + 1, shape.begin() + rank, view.shape.begin());
+
+        std::copy(strides.begin() + 1, strides.begin() + rank, view.strides.begin());
+
+        return view;
+    }
+
+
+    tensor slice(const int &dimension, const std::int64_t &start, const std::int64_t &length) const {
+
+        tensor view = *this;
+
+        view.data += start * strides[dimension];
+
+        view.shape[dimension] = length;
+
+        return view;
+    }
+
+
+    tensor transpose(const int &first, const int &second) const {
+
+        tensor view = *this;
+
+        std::swap(view.shape[first], view.shape[second]);
+
+        std::swap(view.strides[first], view.strides[second]);
+
+        return view;
+    }
+
+
+    tensor reshape(const std::initializer_list<std::int64_t> &dimensions) const {
+        return tensor(data, dimensions);
+    }
+};
+
+
+
+class arena {
+public:
+
+    static constexpr std::size_t alignment = 64;
+
+
+    struct block {
+
+        std::byte* data;
+
+        std::size_t capacity;
+    };
+
+
+    struct marker {
+
+        std::size_t block;
+
+        std::size_t offset;
+
+        std::size_t used;
+    };
+
+
+    std::vector<block> blocks;
+
+    std::size_t current = 0;
+
+    std::size_t offset = 0;
+
+    std::size_t used = 0;
+
+    std::size_t peak = 0;
+
+    std::size_t reserved = 0;
+
+    std::uint64_t blockAllocations = 0;
+
+
+
+    explicit arena(const std::size_t &initialBytes = 1 << 20) {
+        addBlock(initialBytes);
+    }
+
+
+    ~arena() {
+
+        for (const auto& i : blocks) {
+            std::free(i.data);
+        }
+    }
+
+
+    arena(const arena &) = delete;
+
+    arena &operator=(const arena &) = delete;
+
+
+
+    static std::size_t align(const std::size_t &bytes) {
+        return (bytes + alignment - 1) & ~(alignment - 1);
+    }
+
+
+    static std::byte* allocateAligned(const std::size_t &bytes) {
+
+        auto* data = static_cast<std::byte*>(std::aligned_alloc(alignment, align(bytes)));
+
+        if (data == nullptr) {
+            throw std::bad_alloc();
+        }
+
+        allocationCounter::heapAllocations.fetch_add(1, std::memory_order_relaxed);
+
+        return data;
+    }
+
+
+    void addBlock(const std::size_t &bytes) {
+
+        const std::size_t capacity = align(bytes);
+
+        blocks.push_back({allocateAligned(capacity), capacity});
+
+        reserved += capacity;
+
+        blockAllocations++;
+    }
+
+
+
+    void* allocateBytes(std::size_t bytes) {
+
+        bytes = align(std::max<std::size_t>(bytes, 1));
+
+        while (offset + bytes > blocks[current].capacity) {
+
+            if (current + 1 == blocks.size()) {
+                addBlock(std::max(bytes, blocks.back().capacity * 2));
+            }
+
+            current++;
+
+            offset = 0;
+        }
+
+        void* pointer = blocks[current].data + offset;
+
+        offset += bytes;
+
+        used += bytes;
+
+        peak = std::max(peak, used);
+
+        return pointer;
+    }
+
+
+    template<typename T>
+    T* allocateArray(const std::size_t &count) {
+        return static_cast<T*>(allocateBytes(count * sizeof(T)));
+    }
+
+
+    template<typename T>
+    tensor<T> allocate(const std::initializer_list<std::int64_t> &dimensions) {
+
+        tensor<T> result(nullptr, dimensions);
+
+        result.data = allocateArray<T>(result.size());
+
+        return result;
+    }
+
+
+
+    marker mark() const {
+        return {current, offset, used};
+    }
+
+
+    void rewind(const marker &m) {
+
+        current = m.block;
+
+        offset = m.offset;
+
+        used = m.used;
+    }
+
+
+    void reset() {
+
+        if (blocks.size() > 1) {
+
+            const std::size_t capacity = reserved;
+
+            for (const auto& i : blocks) {
+                std::free(i.data);
+            }
+
+            blocks.clear();
+
+            reserved = 0;
+
+            addBlock(capacity);
+        }
+
+        current = 0;
+
+        offset = 0;
+
+        used = 0;
+    }
+};
+
+
+
+class parameterPool {
+public:
+
+    std::vector<std::byte*> blocks;
+
+    std::size_t bytes = 0;
+
+
+
+    parameterPool() = default;
+
+
+    ~parameterPool() {
+
+        for (const auto& i : blocks) {
+            std::free(i);
+        }
+    }
+
+
+    parameterPool(const parameterPool &) = delete;
+
+    parameterPool &operator=(const parameterPool &) = delete;
+
+
+
+    template<typename T>
+    T* allocateArray(const std::size_t &count) {
+
+        const std::size_t size = arena::align(std::max<std::size_t>(count * sizeof(T), 1));
+
+        std::byte* data = arena::allocateAligned(size);
+
+        std::memset(data, 0, size);
+
+        blocks.push_back(data);
+
+        bytes += size;
+
+        return reinterpret_cast<T*>(data);
+    }
+
+
+    template<typename T>
+    tensor<T> allocate(const std::initializer_list<std::int64_t> &dimensions) {
+
+        tensor<T> result(nullptr, dimensions);
+
+        result.data = allocateArray<T>(result.size());
+
+        return result;
+    }
+
+
+    template<typename T>
+    tensor<T> allocateRows(const std::int64_t &rows, const std::int64_t &columns) {
+
+        const std::int64_t stride = static_cast<std::int64_t>(arena::align(columns * sizeof(T)) / sizeof(T));
+
+        tensor<T> result(allocateArray<T>(rows * stride), {rows, columns});
+
+        result.strides[0] = stride;
+
+        return result;
+    }
+};
+
+
+
+
+#endif //TENSOR_H
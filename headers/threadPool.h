@@ -0,0 +1,214 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+class threadPool {
+public:
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+
+    std::mutex runMutex;
+
+    std::condition_variable wake;
+
+    std::condition_variable finished;
+
+    const std::function<void(int, int)>* job = nullptr;
+
+    std::atomic<int> next = 0;
+
+    int count = 0;
+
+    int active = 0;
+
+    std::uint64_t generation = 0;
+
+    std::exception_ptr failure;
+
+    bool stopping = false;
+
+
+
+    explicit threadPool(const int &threads) {
+
+        for (int i = 1; i < threads; i++) {
+
+            workers.emplace_back([this, i] { work(i); });
+        }
+    }
+
+
+    ~threadPool() {
+
+        {
+            std::lock_guard lock(mutex);
+
+            stopping = true;
+        }
+
+        wake.notify_all();
+
+        for (auto& i : workers) {
+            i.join();
+        }
+    }
+
+
+    int size() const {
+        return static_cast<int>(workers.size()) + 1;
+    }
+
+
+    static int &currentThread() {
+
+        thread_local int index = -1;
+
+        return index;
+    }
+
+
+    void drain(const int &threadIndex) {
+
+        currentThread() = threadIndex;
+
+        for (int item = next++; item < count; item = next++) {
+
+            try {
+                (*job)(item, threadIndex);
+            }
+
+            catch (...) {
+
+                std::lock_guard lock(mutex);
+
+                if (!failure) {
+                    failure = std::current_exception();
+                }
+
+                next = count;
+            }
+        }
+
+        currentThread() = -1;
+    }
+
+
+    void work(const int threadIndex) {
+
+        std::uint64_t seen = 0;
+
+        while (true) {
+
+            {
+                std::unique_lock lock(mutex);
+
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+
+                if (stopping) {
+                    return;
+                }
+
+                seen = generation;
+            }
+
+            drain(threadIndex);
+
+            {
+                std::lock_guard lock(mutex);
+
+                active--;
+            }
+
+            finished.notify_one();
+        }
+    }
+
+
+    void run(const int &items, const std::function<void(int, int)> &body) {
+
+        if (items <= 0) {
+            return;
+        }
+
+        if (const int inside = currentThread(); inside >= 0) {
+
+            for (int i = 0; i < items; i++) {
+                body(i, inside);
+            }
+
+            return;
+        }
+
+        std::lock_guard serialize(runMutex);
+
+        if (workers.empty() || items == 1) {
+
+            for (int i = 0; i < items; i++) {
+                body(i, 0);
+            }
+
+            return;
+        }
+
+        {
+            std::lock_guard lock(mutex);
+
+            job = &body;
+
+            count = items;
+
+            next = 0;
+
+            active = static_cast<int>(workers.size());
+
+            generation++;
+        }
+
+        wake.notify_all();
+
+        drain(0);
+
+        std::unique_lock lock(mutex);
+
+        finished.wait(lock, [&] { return active == 0; });
+
+        job = nullptr;
+
+        if (failure) {
+            std::rethrow_exception(std::exchange(failure, nullptr));
+        }
+    }
+
+
+
+    static threadPool &instance() {
+
+        static threadPool pool(std::max(1, static_cast<int>(std::thread::hardware_concurrency())));
+
+        return pool;
+    }
+
+
+    static void parallelFor(const int &items, const std::function<void(int, int)> &body) {
+        instance().run(items, body);
+    }
+};
+
+
+
+
+#endif //THREADPOOL_H
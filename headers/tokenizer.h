@@ -15,6 +15,8 @@
 #include <string_view>
 #include <regex>
 
+#include "vocabularyImage.h"
+
 
 class tokenizer {
 public:
@@ -222,38 +224,38 @@ public:
     static std::vector<int> tokenizeWord(const std::string &word,
         const trieNode* root) {
 
-        const trieNode* node = root;
-
         std::vector<int> tempTokens;
 
-        int index = 0;
+        for (size_t start = 0; start < word.size();) {
 
-        int token = -1;
+            const trieNode* node = root;
 
-        for (int i = 0; i < word.size();) {
+            int token = -1;
 
-            if (node->children[word[i] - 'a'] != nullptr) {
+            size_t end = start + 1;
+
+            for (size_t i = start; i < word.size(); i++) {
 
                 node = node->children[word[i] - 'a'];
 
+                if (node == nullptr) {
+                    break;
+                }
+
                 if (node->index != -1) {
 
                     token = node->index;
-                    index = i;
-                }
 
-                i++;
+                    end = i + 1;
+                }
             }
 
-            else {
-
+            if (token >= 0) {
                 tempTokens.push_back(token);
-                i = index + 1;
-                node = root;
             }
-        }
 
-        tempTokens.push_back(token);
+            start = end;
+        }
 
         return tempTokens;
     }
@@ -337,9 +339,21 @@ public:
 
         vocabulary.reserve(30000);
 
-        std::ifstream vocabularyFileIn("../output/vocabulary.txt");
+        vocabularyImage image;
 
-        loadVocabulary(vocabularyFileIn, vocabulary);
+        vocabularyImage::load(image);
+
+        for (int i = 0; i < image.size(); i++) {
+            vocabulary.emplace_back(image.token(i));
+        }
+
+        vocabularyImage::unmap(image);
+
+        std::vector<std::int32_t> mergePairs;
+
+        if (!vocabularyImage::readMerges(vocabularyImage::mergesPath("../output/vocabulary.txt"), vocabulary, mergePairs)) {
+            vocabularyImage::rebuildMerges(vocabulary, mergePairs);
+        }
 
         auto *root = new trieNode();
 
@@ -421,6 +435,10 @@ public:
 
             vocabulary.push_back(vocabulary[max.first.first] + vocabulary[max.first.second]);
 
+            mergePairs.push_back(max.first.first);
+
+            mergePairs.push_back(max.first.second);
+
 
             std::cout << vocabulary[max.first.first] + vocabulary[max.first.second] << " : " << max.second << "\n";
 
@@ -432,6 +450,10 @@ public:
         outputVocabulary(vocabularyFileOut, vocabulary);
 
         vocabularyFileOut.close();
+
+        vocabularyImage::writeMerges(vocabularyImage::mergesPath("../output/vocabulary.txt"), mergePairs);
+
+        vocabularyImage::compile(vocabulary, "../output/vocabulary.bin", mergePairs);
     }
 };
 
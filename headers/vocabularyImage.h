@@ -0,0 +1,753 @@
+#ifndef VOCABULARYIMAGE_H
+#define VOCABULARYIMAGE_H
+
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+class vocabularyImage {
+public:
+
+    static constexpr char magic[8] = {'S', 'W', 'G', 'V', 'O', 'C', 'A', 'B'};
+
+    static constexpr std::uint32_t version = 1;
+
+
+    struct header {
+
+        char magic[8];
+
+        std::uint32_t version;
+
+        std::uint32_t tokenCount;
+
+        std::uint32_t nodeCount;
+
+        std::uint32_t hasMerges;
+
+        std::uint64_t poolBytes;
+
+        std::uint64_t offsetsOffset;
+
+        std::uint64_t poolOffset;
+
+        std::uint64_t nodesOffset;
+
+        std::uint64_t mergesOffset;
+
+        std::uint64_t fileBytes;
+    };
+
+
+    struct node {
+
+        std::int32_t children[26];
+
+        std::int32_t index;
+    };
+
+
+    const header* head = nullptr;
+
+    const std::uint64_t* offsets = nullptr;
+
+    const char* pool = nullptr;
+
+    const node* nodes = nullptr;
+
+    const std::int32_t* merges = nullptr;
+
+    void* mapped = nullptr;
+
+    size_t mappedBytes = 0;
+
+
+
+    int size() const {
+        return static_cast<int>(head->tokenCount);
+    }
+
+
+    std::string_view token(const int &index) const {
+        return {pool + offsets[index], static_cast<size_t>(offsets[index + 1] - offsets[index])};
+    }
+
+
+    int find(const std::string_view &word) const {
+
+        int current = 0;
+
+        for (const char c : word) {
+
+            if (c < 'a' || c > 'z' || nodes[current].children[c - 'a'] < 0) {
+                return -1;
+            }
+
+            current = nodes[current].children[c - 'a'];
+        }
+
+        return nodes[current].index;
+    }
+
+
+    static void tokenizeWord(const std::string_view &word, const vocabularyImage &image, std::vector<int> &tokenizedWords) {
+
+        const node* nodes = image.nodes;
+
+        for (size_t start = 0; start < word.size();) {
+
+            int current = 0;
+
+            int token = -1;
+
+            size_t end = start + 1;
+
+            for (size_t i = start; i < word.size(); i++) {
+
+                current = nodes[current].children[word[i] - 'a'];
+
+                if (current < 0) {
+                    break;
+                }
+
+                if (nodes[current].index != -1) {
+
+                    token = nodes[current].index;
+
+                    end = i + 1;
+                }
+            }
+
+            if (token >= 0) {
+                tokenizedWords.push_back(token);
+            }
+
+            start = end;
+        }
+    }
+
+
+    static void tokenizeWords(const std::vector<std::string> &words, const vocabularyImage &image, std::vector<int> &tokenizedWords) {
+
+        for (const auto& word : words) {
+
+            tokenizeWord(word, image, tokenizedWords);
+        }
+    }
+
+
+
+    static size_t align(const size_t &offset) {
+        return (offset + 63) & ~static_cast<size_t>(63);
+    }
+
+
+    static std::uint64_t pairKey(const int &left, const int &right) {
+        return static_cast<std::uint64_t>(static_cast<std::uint32_t>(left)) << 32 | static_cast<std::uint32_t>(right);
+    }
+
+
+    static void rebuildMerges(const std::vector<std::string> &vocabulary, std::vector<std::int32_t> &mergePairs) {
+
+        int letters[26];
+
+        std::fill(std::begin(letters), std::end(letters), -1);
+
+        for (size_t i = 0; i < vocabulary.size(); i++) {
+
+            if (vocabulary[i].size() == 1 && letters[vocabulary[i][0] - 'a'] < 0) {
+                letters[vocabulary[i][0] - 'a'] = static_cast<int>(i);
+            }
+        }
+
+        std::unordered_map<std::uint64_t, int> ranks;
+
+        std::vector<int> pieces;
+
+        mergePairs.assign(vocabulary.size() * 2, -1);
+
+        for (size_t i = 0; i < vocabulary.size(); i++) {
+
+            const std::string &word = vocabulary[i];
+
+            if (word.size() < 2) {
+                continue;
+            }
+
+            pieces.clear();
+
+            for (const char c : word) {
+                pieces.push_back(letters[c - 'a']);
+            }
+
+            if (std::find(pieces.begin(), pieces.end(), -1) != pieces.end()) {
+                continue;
+            }
+
+            while (pieces.size() > 2) {
+
+                int best = -1;
+
+                int bestRank = std::numeric_limits<int>::max();
+
+                for (size_t j = 0; j + 1 < pieces.size(); j++) {
+
+                    const auto rank = ranks.find(pairKey(pieces[j], pieces[j + 1]));
+
+                    if (rank != ranks.end() && rank->second < bestRank) {
+
+                        best = static_cast<int>(j);
+
+                        bestRank = rank->second;
+                    }
+                }
+
+                if (best < 0) {
+                    break;
+                }
+
+                pieces[best] = bestRank;
+
+                pieces.erase(pieces.begin() + best + 1);
+            }
+
+            if (pieces.size() == 2) {
+
+                mergePairs[i * 2] = pieces[0];
+
+                mergePairs[i * 2 + 1] = pieces[1];
+
+                ranks.emplace(pairKey(pieces[0], pieces[1]), static_cast<int>(i));
+            }
+        }
+    }
+
+
+    static std::string mergesPath(const std::string &vocabularyPath) {
+        return (std::filesystem::path(vocabularyPath).parent_path() / "merges.txt").string();
+    }
+
+
+    static void writeMerges(const std::string &path, const std::vector<std::int32_t> &mergePairs) {
+
+        std::ofstream file(path);
+
+        if (!file) {
+            throw std::runtime_error("vocabularyImage : cannot open " + path);
+        }
+
+        for (size_t i = 0; i + 1 < mergePairs.size(); i += 2) {
+            file << mergePairs[i] << " " << mergePairs[i + 1] << "\n";
+        }
+
+        if (!file) {
+            throw std::runtime_error("vocabularyImage : cannot write " + path);
+        }
+    }
+
+
+    static bool readMerges(const std::string &path, const std::vector<std::string> &vocabulary, std::vector<std::int32_t> &mergePairs) {
+
+        std::ifstream file(path);
+
+        if (!file) {
+            return false;
+        }
+
+        mergePairs.clear();
+
+        mergePairs.reserve(vocabulary.size() * 2);
+
+        std::int32_t left, right;
+
+        while (file >> left >> right) {
+
+            const size_t i = mergePairs.size() / 2;
+
+            if (i >= vocabulary.size()) {
+                throw std::runtime_error("vocabularyImage : " + path + " has more lines than the vocabulary");
+            }
+
+            if (left >= 0 || right >= 0) {
+
+                if (left < 0 || right < 0 || static_cast<size_t>(left) >= i || static_cast<size_t>(right) >= i
+                    || vocabulary[left] + vocabulary[right] != vocabulary[i]) {
+                    throw std::runtime_error("vocabularyImage : " + path + " line " + std::to_string(i + 1) + " is not a merge of two earlier tokens");
+                }
+            }
+
+            mergePairs.push_back(left);
+
+            mergePairs.push_back(right);
+        }
+
+        if (!file.eof() || mergePairs.size() != vocabulary.size() * 2) {
+            throw std::runtime_error("vocabularyImage : " + path + " does not match the vocabulary");
+        }
+
+        return true;
+    }
+
+
+    static void writeAtomically(const std::string &path, const std::vector<char> &bytes) {
+
+        std::string temporaryPath = path + ".XXXXXX";
+
+        const int fd = mkstemp(temporaryPath.data());
+
+        if (fd < 0) {
+            throw std::runtime_error("vocabularyImage : cannot create a temporary file next to " + path);
+        }
+
+        size_t written = 0;
+
+        while (written < bytes.size()) {
+
+            const ssize_t result = write(fd, bytes.data() + written, bytes.size() - written);
+
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (result <= 0) {
+
+                close(fd);
+
+                unlink(temporaryPath.c_str());
+
+                throw std::runtime_error("vocabularyImage : cannot write " + temporaryPath);
+            }
+
+            written += result;
+        }
+
+        fchmod(fd, 0644);
+
+        close(fd);
+
+        std::filesystem::rename(temporaryPath, path);
+    }
+
+
+    static void compile(const std::vector<std::string> &vocabulary, const std::string &imagePath, const std::vector<std::int32_t> &mergePairs) {
+
+        if (vocabulary.empty()) {
+            throw std::runtime_error("vocabularyImage : empty vocabulary, " + imagePath + " not written");
+        }
+
+        if (!mergePairs.empty() && mergePairs.size() != vocabulary.size() * 2) {
+            throw std::runtime_error("vocabularyImage : merge table does not match the vocabulary");
+        }
+
+        std::vector<std::uint64_t> tokenOffsets;
+
+        std::string tokenPool;
+
+        tokenOffsets.reserve(vocabulary.size() + 1);
+
+        for (size_t i = 0; i < vocabulary.size(); i++) {
+
+            const std::string &word = vocabulary[i];
+
+            if (word.empty() || !std::all_of(word.begin(), word.end(), [](const char c) { return c >= 'a' && c <= 'z'; })) {
+                throw std::runtime_error("vocabularyImage : token " + std::to_string(i) + " is not a lowercase word");
+            }
+
+            tokenOffsets.push_back(tokenPool.size());
+
+            tokenPool += word;
+        }
+
+        tokenOffsets.push_back(tokenPool.size());
+
+
+        std::vector<node> trie(1);
+
+        std::fill(std::begin(trie[0].children), std::end(trie[0].children), -1);
+
+        trie[0].index = -1;
+
+        for (size_t i = 0; i < vocabulary.size(); i++) {
+
+            int current = 0;
+
+            for (const char c : vocabulary[i]) {
+
+                if (trie[current].children[c - 'a'] < 0) {
+
+                    trie[current].children[c - 'a'] = static_cast<std::int32_t>(trie.size());
+
+                    trie.emplace_back();
+
+                    std::fill(std::begin(trie.back().children), std::end(trie.back().children), -1);
+
+                    trie.back().index = -1;
+                }
+
+                current = trie[current].children[c - 'a'];
+            }
+
+            trie[current].index = static_cast<std::int32_t>(i);
+        }
+
+
+        header h{};
+
+        std::memcpy(h.magic, magic, sizeof(magic));
+
+        h.version = version;
+
+        h.tokenCount = static_cast<std::uint32_t>(vocabulary.size());
+
+        h.nodeCount = static_cast<std::uint32_t>(trie.size());
+
+        h.hasMerges = !mergePairs.empty();
+
+        h.poolBytes = tokenPool.size();
+
+        h.offsetsOffset = align(sizeof(header));
+
+        h.poolOffset = align(h.offsetsOffset + tokenOffsets.size() * sizeof(std::uint64_t));
+
+        h.nodesOffset = align(h.poolOffset + tokenPool.size());
+
+        h.mergesOffset = align(h.nodesOffset + trie.size() * sizeof(node));
+
+        h.fileBytes = h.mergesOffset + mergePairs.size() * sizeof(std::int32_t);
+
+
+        std::vector<char> image(h.fileBytes);
+
+        std::memcpy(image.data(), &h, sizeof(h));
+
+        std::memcpy(image.data() + h.offsetsOffset, tokenOffsets.data(), tokenOffsets.size() * sizeof(std::uint64_t));
+
+        std::memcpy(image.data() + h.poolOffset, tokenPool.data(), tokenPool.size());
+
+        std::memcpy(image.data() + h.nodesOffset, trie.data(), trie.size() * sizeof(node));
+
+        std::memcpy(image.data() + h.mergesOffset, mergePairs.data(), mergePairs.size() * sizeof(std::int32_t));
+
+        writeAtomically(imagePath, image);
+    }
+
+
+    static void compile(const std::vector<std::string> &vocabulary, const std::string &imagePath, const bool &withMerges = true) {
+
+        std::vector<std::int32_t> mergePairs;
+
+        if (withMerges) {
+            rebuildMerges(vocabulary, mergePairs);
+        }
+
+        compile(vocabulary, imagePath, mergePairs);
+    }
+
+
+    static void compile(const std::string &vocabularyPath, const std::string &imagePath, const bool &withMerges = true) {
+
+        std::vector<std::string> vocabulary;
+
+        std::ifstream vocabularyFile(vocabularyPath);
+
+        if (!vocabularyFile) {
+            throw std::runtime_error("vocabularyImage : cannot open " + vocabularyPath);
+        }
+
+        std::string line;
+
+        while (std::getline(vocabularyFile, line)) {
+            vocabulary.push_back(line);
+        }
+
+        if (vocabulary.empty()) {
+            throw std::runtime_error("vocabularyImage : " + vocabularyPath + " is empty");
+        }
+
+        std::vector<std::int32_t> mergePairs;
+
+        if (withMerges && !readMerges(mergesPath(vocabularyPath), vocabulary, mergePairs)) {
+            rebuildMerges(vocabulary, mergePairs);
+        }
+
+        compile(vocabulary, imagePath, mergePairs);
+    }
+
+
+
+    static bool map(const std::string &imagePath, vocabularyImage &image) {
+
+        const int fd = open(imagePath.c_str(), O_RDONLY);
+
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat status{};
+
+        fstat(fd, &status);
+
+        const size_t bytes = status.st_size;
+
+        if (bytes < sizeof(header)) {
+
+            close(fd);
+
+            return false;
+        }
+
+        void* mapped = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+
+        close(fd);
+
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+
+        const auto* h = static_cast<const header*>(mapped);
+
+        if (std::memcmp(h->magic, magic, sizeof(magic)) != 0 || h->version != version || h->fileBytes != bytes) {
+
+            munmap(mapped, bytes);
+
+            return false;
+        }
+
+        const char* base = static_cast<const char*>(mapped);
+
+        image.head = h;
+
+        image.offsets = reinterpret_cast<const std::uint64_t*>(base + h->offsetsOffset);
+
+        image.pool = base + h->poolOffset;
+
+        image.nodes = reinterpret_cast<const node*>(base + h->nodesOffset);
+
+        image.merges = h->hasMerges ? reinterpret_cast<const std::int32_t*>(base + h->mergesOffset) : nullptr;
+
+        image.mapped = mapped;
+
+        image.mappedBytes = bytes;
+
+        return true;
+    }
+
+
+    static void unmap(vocabularyImage &image) {
+
+        if (image.mapped != nullptr) {
+            munmap(image.mapped, image.mappedBytes);
+        }
+
+        image = vocabularyImage();
+    }
+
+
+    static void load(vocabularyImage &image,
+        const std::string &vocabularyPath = "../output/vocabulary.txt",
+        const std::string &imagePath = "../output/vocabulary.bin") {
+
+        std::error_code error;
+
+        const std::string merges = mergesPath(vocabularyPath);
+
+        const bool stale = !std::filesystem::exists(imagePath, error)
+        || (std::filesystem::exists(vocabularyPath, error)
+            && std::filesystem::last_write_time(vocabularyPath, error) > std::filesystem::last_write_time(imagePath, error))
+        || (std::filesystem::exists(merges, error)
+            && std::filesystem::last_write_time(merges, error) > std::filesystem::last_write_time(imagePath, error));
+
+        if (!stale && map(imagePath, image)) {
+            return;
+        }
+
+        compile(vocabularyPath, imagePath);
+
+        if (!map(imagePath, image)) {
+            throw std::runtime_error("vocabularyImage : cannot map " + imagePath);
+        }
+    }
+
+
+
+    static void dropFromPageCache(const std::string &path) {
+
+        const int fd = open(path.c_str(), O_RDONLY);
+
+        if (fd >= 0) {
+
+            fdatasync(fd);
+
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+            close(fd);
+        }
+    }
+
+
+
+    static void benchmarkStartup() {
+
+        const std::string vocabularyPath = "../output/vocabulary.txt";
+
+        const std::string imagePath = "../output/vocabulary.bin";
+
+        compile(vocabularyPath, imagePath);
+
+        constexpr int runs = 21;
+
+        const std::vector<std::string> probe = {"transformer"};
+
+
+        struct textNode {
+
+            textNode* children[26]{};
+
+            int index = -1;
+
+            ~textNode() {
+                for (auto& i : children) {
+                    delete i;
+                }
+            }
+        };
+
+
+        auto textStartup = [&] {
+
+            const auto start = std::chrono::high_resolution_clock::now();
+
+            std::ifstream vocabularyFile(vocabularyPath);
+
+            std::string line;
+
+            int index = 0;
+
+            auto* root = new textNode;
+
+            while (std::getline(vocabularyFile, line)) {
+
+                textNode* node = root;
+
+                for (const char c : line) {
+
+                    if (node->children[c - 'a'] == nullptr) {
+                        node->children[c - 'a'] = new textNode;
+                    }
+
+                    node = node->children[c - 'a'];
+                }
+
+                node->index = index++;
+            }
+
+            std::vector<int> tokens;
+
+            for (const auto& word : probe) {
+
+                for (size_t wordStart = 0; wordStart < word.size();) {
+
+                    const textNode* node = root;
+
+                    int token = -1;
+
+                    size_t end = wordStart + 1;
+
+                    for (size_t i = wordStart; i < word.size() && (node = node->children[word[i] - 'a']) != nullptr; i++) {
+
+                        if (node->index != -1) {
+
+                            token = node->index;
+
+                            end = i + 1;
+                        }
+                    }
+
+                    if (token >= 0) {
+                        tokens.push_back(token);
+                    }
+
+                    wordStart = end;
+                }
+            }
+
+            const std::chrono::duration<double, std::micro> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+            delete root;
+
+            return elapsed.count();
+        };
+
+
+        auto imageStartup = [&] {
+
+            const auto start = std::chrono::high_resolution_clock::now();
+
+            vocabularyImage image;
+
+            map(imagePath, image);
+
+            std::vector<int> tokens;
+
+            tokenizeWords(probe, image, tokens);
+
+            const std::chrono::duration<double, std::micro> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+            unmap(image);
+
+            return elapsed.count();
+        };
+
+
+        auto median = [&](const auto &startup, const bool &cold) {
+
+            std::vector<double> times;
+
+            for (int i = 0; i < runs; i++) {
+
+                if (cold) {
+                    dropFromPageCache(vocabularyPath);
+                    dropFromPageCache(imagePath);
+                }
+
+                times.push_back(startup());
+            }
+
+            std::sort(times.begin(), times.end());
+
+            return times[runs / 2];
+        };
+
+
+        std::cout << "path,cold_us,warm_us\n";
+
+        std::cout << "text," << median(textStartup, true) << "," << median(textStartup, false) << "\n";
+
+        std::cout << "image," << median(imageStartup, true) << "," << median(imageStartup, false) << "\n";
+
+        std::cout << "image size : " << std::filesystem::file_size(imagePath) << " bytes\n";
+    }
+};
+
+
+
+
+#endif //VOCABULARYIMAGE_H
@@ -1,11 +1,255 @@
 #include "../headers/tokenizer.h"
 #include "../headers/embedding.h"
+#include "../headers/dataParallel.h"
+#include "../headers/server.h"
+#include "../headers/attention.h"
+#include "../headers/feedForward.h"
+#include "../headers/generator.h"
+#include "../headers/dataLoader.h"
+#include "../headers/encoder.h"
+#include "../headers/detokenizer.h"
+#include "../headers/evaluation.h"
 
 
-int main() {
+static void* countedAllocate(const std::size_t &size, const std::size_t &alignment) {
 
-    embedding::embed();
+    allocationCounter::heapAllocations.fetch_add(1, std::memory_order_relaxed);
+
+    const std::size_t bytes = size == 0 ? 1 : size;
+
+    if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        return std::malloc(bytes);
+    }
+
+    return std::aligned_alloc(alignment, (bytes + alignment - 1) / alignment * alignment);
+}
+
+
+static void* countedAllocateOrThrow(const std::size_t &size, const std::size_t &alignment) {
+
+    if (void* pointer = countedAllocate(size, alignment)) {
+        return pointer;
+    }
+
+    throw std::bad_alloc();
+}
+
+
+[[gnu::noinline]] static void countedRelease(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+
+void* operator new(const std::size_t size) {
+    return countedAllocateOrThrow(size, 0);
+}
+
+
+void* operator new[](const std::size_t size) {
+    return countedAllocateOrThrow(size, 0);
+}
+
+
+void* operator new(const std::size_t size, const std::align_val_t alignment) {
+    return countedAllocateOrThrow(size, static_cast<std::size_t>(alignment));
+}
+
+
+void* operator new[](const std::size_t size, const std::align_val_t alignment) {
+    return countedAllocateOrThrow(size, static_cast<std::size_t>(alignment));
+}
+
+
+void* operator new(const std::size_t size, const std::nothrow_t &) noexcept {
+    return countedAllocate(size, 0);
+}
+
+
+void* operator new[](const std::size_t size, const std::nothrow_t &) noexcept {
+    return countedAllocate(size, 0);
+}
+
+
+void* operator new(const std::size_t size, const std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    return countedAllocate(size, static_cast<std::size_t>(alignment));
+}
+
+
+void* operator new[](const std::size_t size, const std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    return countedAllocate(size, static_cast<std::size_t>(alignment));
+}
+
+
+void operator delete(void* pointer) noexcept {
+    countedRelease(pointer);
+}
+
+
+void operator delete[](void* pointer) noexcept {
+    countedRelease(pointer);
+}
+
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    countedRelease(pointer);
+}
+
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+    countedRelease(pointer);
+}
+
+
+void operator delete(void* pointer, std::align_val_t) noexcept {
+    countedRelease(pointer);
+}
+
+
+void operator delete[](void* pointer, std::align_val_t) noexcept {
+    countedRelease(pointer);
+}
+
+
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept {
+    countedRelease(pointer);
+}
+
+
+void operator delete[](void* pointer, std::size_t, std::align_val_t) noexcept {
+    countedRelease(pointer);
+}
+
+
+void operator delete(void* pointer, const std::nothrow_t &) noexcept {
+    countedRelease(pointer);
+}
+
+
+void operator delete[](void* pointer, const std::nothrow_t &) noexcept {
+    countedRelease(pointer);
+}
+
+
+void operator delete(void* pointer, std::align_val_t, const std::nothrow_t &) noexcept {
+    countedRelease(pointer);
+}
+
+
+void operator delete[](void* pointer, std::align_val_t, const std::nothrow_t &) noexcept {
+    countedRelease(pointer);
+}
+
+
+int main(int argc, char* argv[]) {
+
+    const std::string mode = argc > 1 ? argv[1] : "embed";
+
+    if (mode == "benchmark-steps") {
+
+        embedding::benchmarkTrainSteps();
+    }
+
+    else if (mode == "benchmark-precision") {
+
+        embedding::benchmarkPrecision();
+    }
+
+    else if (mode == "benchmark-memory") {
+
+        embedding::benchmarkMemory();
+    }
+
+    else if (mode == "embed-bf16") {
+
+        embedding::embed<embedding::bfloat16>();
+    }
+
+    else if (mode == "embed-parallel") {
+
+        const int workers = argc > 2 ? std::stoi(argv[2]) : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+        const int syncInterval = argc > 3 ? std::stoi(argv[3]) : 16;
+
+        dataParallel::embed(workers, syncInterval, true);
+    }
+
+    else if (mode == "benchmark-scaling") {
+
+        dataParallel::benchmarkScaling();
+    }
+
+    else if (mode == "benchmark-startup") {
+
+        vocabularyImage::benchmarkStartup();
+    }
+
+    else if (mode == "benchmark-attention") {
+
+        attention::benchmark(argc > 2 ? std::stoi(argv[2]) : 8192);
+    }
+
+    else if (mode == "benchmark-ffn") {
+
+        feedForward::benchmark();
+    }
+
+    else if (mode == "generate") {
+
+        const std::vector<std::string> prompts(argv + std::min(argc, 2), argv + argc);
+
+        generator::run(prompts.empty() ? std::vector<std::string>{"the history of"} : prompts, 20);
+    }
+
+    else if (mode == "benchmark-decode") {
+
+        generator::benchmark(argc > 2 ? std::stoi(argv[2]) : 256);
+    }
+
+    else if (mode == "tokenize-corpus") {
+
+        dataLoader::compileCorpus("/home/swann7777777/Documents/simplewiki-20250701-pages-articles-multistream.xml", "../output/tokens.bin");
+    }
+
+    else if (mode == "benchmark-loader") {
+
+        dataLoader::benchmark(argc > 2 ? std::stoi(argv[2]) : 8, argc > 3 ? std::stoi(argv[3]) : 256);
+    }
+
+    else if (mode == "encode" && argc > 3) {
+
+        encoder::encodeFile(argv[2], argv[3], encoder::formatOf(argv[2], argc > 4 ? argv[4] : ""));
+    }
+
+    else if (mode == "encode-check" && argc > 3) {
+
+        return encoder::roundTrip(argv[2], argv[3], encoder::formatOf(argv[2], argc > 4 ? argv[4] : "")) ? 0 : 1;
+    }
+
+    else if (mode == "benchmark-detokenize") {
+
+        detokenizer::benchmark(argc > 2 ? argv[2] : "");
+    }
+
+    else if (mode == "evaluate") {
+
+        evaluation::run(argc > 2 ? argv[2] : "../output/embeddings.bin");
+    }
+
+    else if (mode == "serve") {
+
+        server::serve(argc > 2 ? argv[2] : "/tmp/swagggpt.sock");
+    }
+
+    else if (mode == "load-test") {
+
+        server::loadTest(argc > 2 ? argv[2] : "/tmp/swagggpt.sock");
+    }
+
+    else {
+
+        embedding::embed();
+    }
 
     return 0;
 
-}
\ No newline at end of file
+}